@@ -22,6 +22,7 @@
                 'libraries': [
                     '-lcrypto'
                 ]
+              , 'cflags_cc': [ '-std=c++0x' ]
             }]
           , ['OS == "solaris"', {
             }]
@@ -76,9 +77,15 @@
             'src/nssh.cc'
           , 'src/server.cc'
           , 'src/session.cc'
+          , 'src/kex_pool.cc'
           , 'src/channel.cc'
+          , 'src/channel_exec.cc'
+          , 'src/file_sender.cc'
           , 'src/message.cc'
           , 'src/sftp_message.cc'
+          , 'src/tcp_relay.cc'
+          , 'src/tcp_forward.cc'
+          , 'src/sftp_server.cc'
         ]
     }]
 }
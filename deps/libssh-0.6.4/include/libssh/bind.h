@@ -44,6 +44,7 @@ struct ssh_bind_struct {
   unsigned int bindport;
   int blocking;
   int toaccept;
+  int reuseport;
 };
 
 struct ssh_poll_handle_struct *ssh_bind_get_poll(struct ssh_bind_struct
@@ -679,6 +679,23 @@ typedef int (*ssh_channel_subsystem_request_callback) (ssh_session session,
                                             const char *subsystem,
                                             void *userdata);
 
+/**
+ * @brief SSH channel write will not block (flow control).
+ *
+ * Called when the remote side has opened the channel's window so that
+ * writes of up to the given size can go out without waiting. It's called
+ * while packets are being handled so it shouldn't write to the channel
+ * itself.
+ *
+ * @param channel the channel
+ * @param bytes size of the remote window in bytes.
+ * @param userdata Userdata to be passed to the callback function.
+ */
+typedef void (*ssh_channel_write_wontblock_callback) (ssh_session session,
+                                            ssh_channel channel,
+                                            size_t bytes,
+                                            void *userdata);
+
 
 struct ssh_channel_callbacks_struct {
   /** DON'T SET THIS use ssh_callbacks_init() instead. */
@@ -743,6 +760,10 @@ struct ssh_channel_callbacks_struct {
    * (like sftp).
    */
   ssh_channel_subsystem_request_callback channel_subsystem_request_function;
+  /** This function will be called when the channel write is guaranteed
+   * not to block.
+   */
+  ssh_channel_write_wontblock_callback channel_write_wontblock_function;
 };
 
 typedef struct ssh_channel_callbacks_struct *ssh_channel_callbacks;
@@ -57,6 +57,22 @@ enum ssh_key_exchange_e {
   SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG
 };
 
+/* an ephemeral server keypair made ahead of the key exchange it's used in */
+struct ssh_kex_keypair_struct {
+    enum ssh_key_exchange_e type;
+    bignum y, f;
+#ifdef HAVE_ECDH
+    EC_KEY *ecdh_privkey;
+    ssh_string ecdh_pubkey;
+#endif
+#ifdef HAVE_CURVE25519
+    ssh_curve25519_privkey curve25519_privkey;
+    ssh_curve25519_pubkey curve25519_pubkey;
+#endif
+};
+
+struct ssh_kex_keypair_struct *ssh_server_kex_keypair(ssh_session session);
+
 struct ssh_crypto_struct {
     bignum e,f,x,k,y;
 #ifdef HAVE_ECDH
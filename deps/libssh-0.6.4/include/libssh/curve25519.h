@@ -52,6 +52,9 @@ int ssh_client_curve25519_reply(ssh_session session, ssh_buffer packet);
 
 #ifdef WITH_SERVER
 int ssh_server_curve25519_init(ssh_session session, ssh_buffer packet);
+int ssh_server_curve25519_compute(ssh_session session);
+int ssh_curve25519_generate_keypair(ssh_curve25519_privkey privkey,
+                                    ssh_curve25519_pubkey pubkey);
 #endif /* WITH_SERVER */
 
 #endif /* CURVE25519_H_ */
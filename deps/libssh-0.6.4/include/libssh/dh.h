@@ -30,6 +30,7 @@ int dh_generate_e(ssh_session session);
 int dh_generate_f(ssh_session session);
 int dh_generate_x(ssh_session session);
 int dh_generate_y(ssh_session session);
+int dh_generate_keypair(enum ssh_key_exchange_e type, bignum *y, bignum *f);
 
 int ssh_crypto_init(void);
 void ssh_crypto_finalize(void);
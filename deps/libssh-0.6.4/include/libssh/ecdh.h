@@ -38,6 +38,11 @@ int ssh_client_ecdh_reply(ssh_session session, ssh_buffer packet);
 
 #ifdef WITH_SERVER
 int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet);
+int ssh_server_ecdh_compute(ssh_session session);
+#ifdef HAVE_ECDH
+#include <openssl/ec.h>
+int ecdh_generate_keypair(EC_KEY **key, ssh_string *pubkey);
+#endif
 #endif /* WITH_SERVER */
 
 #endif /* ECDH_H_ */
@@ -56,6 +56,7 @@ struct ssh_key_struct {
 #endif /* HAVE_OPENSSL_EC_H */
 #endif
     void *cert;
+    int refcount; /* references held in addition to the owner's */
 };
 
 struct ssh_signature_struct {
@@ -80,6 +81,7 @@ typedef struct ssh_signature_struct *ssh_signature;
 
 /* SSH Key Functions */
 ssh_key ssh_key_dup(const ssh_key key);
+ssh_key ssh_key_ref(ssh_key key);
 void ssh_key_clean (ssh_key key);
 
 /* SSH Signature Functions */
@@ -173,6 +173,7 @@ struct ssh_common_struct;
 struct ssh_kex_struct;
 
 int ssh_get_key_params(ssh_session session, ssh_key *privkey);
+int ssh_server_kex_continue(ssh_session session);
 
 /* LOGGING */
 void ssh_log_function(int verbosity,
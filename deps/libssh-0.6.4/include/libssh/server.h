@@ -45,7 +45,8 @@ enum ssh_bind_options_e {
   SSH_BIND_OPTIONS_BANNER,
   SSH_BIND_OPTIONS_LOG_VERBOSITY,
   SSH_BIND_OPTIONS_LOG_VERBOSITY_STR,
-  SSH_BIND_OPTIONS_ECDSAKEY
+  SSH_BIND_OPTIONS_ECDSAKEY,
+  SSH_BIND_OPTIONS_REUSEPORT
 };
 
 typedef struct ssh_bind_struct* ssh_bind;
@@ -93,6 +94,19 @@ LIBSSH_API int ssh_bind_options_set(ssh_bind sshbind,
  */
 LIBSSH_API int ssh_bind_listen(ssh_bind ssh_bind_o);
 
+/**
+ * @brief Re-read the host key files set on the bind.
+ *
+ * Sessions share the bind's host keys rather than holding copies, sessions
+ * that are already connected keep using the keys they were accepted with.
+ * If any key fails to import the previous keys are left in place.
+ *
+ * @param  ssh_bind_o     The ssh server bind to use.
+ *
+ * @return SSH_OK on success, SSH_ERROR otherwise.
+ */
+LIBSSH_API int ssh_bind_reload_keys(ssh_bind ssh_bind_o);
+
 /**
  * @brief Set the callback for this bind.
  *
@@ -156,7 +170,9 @@ LIBSSH_API void ssh_bind_fd_toaccept(ssh_bind ssh_bind_o);
  * @param  ssh_bind_o     The ssh server bind to accept a connection.
  * @param  session			A preallocated ssh session
  * @see ssh_new
- * @return SSH_OK when a connection is established
+ * @return SSH_OK when a connection is established, SSH_AGAIN if the bind
+ *         is non-blocking and there are no pending connections (the
+ *         session is left untouched and can be reused)
  */
 LIBSSH_API int ssh_bind_accept(ssh_bind ssh_bind_o, ssh_session session);
 
@@ -186,6 +202,104 @@ LIBSSH_API ssh_gssapi_creds ssh_gssapi_get_creds(ssh_session session);
  */
 LIBSSH_API int ssh_handle_key_exchange(ssh_session session);
 
+/**
+ * @brief Called when the client's KEXDH_INIT has been parsed and the server
+ *        reply is ready to be computed.
+ *
+ * The session must not be used until ssh_server_kex_compute() has been
+ * run (from any thread) and ssh_server_kex_reply() has been called.
+ */
+typedef void (*ssh_kex_offload_callback) (ssh_session session, void *userdata);
+
+/**
+ * @brief Defer the expensive part of the server key exchange reply to the
+ *        caller instead of doing it inline while handling packets.
+ *
+ * @param  session      The ssh server session.
+ * @param  cb           The callback, or NULL to compute inline (default).
+ * @param  userdata     Passed through to the callback.
+ */
+LIBSSH_API void ssh_set_kex_offload_callback(ssh_session session,
+    ssh_kex_offload_callback cb, void *userdata);
+
+/**
+ * @brief Compute the shared secret and sign the exchange hash for a pending
+ *        server key exchange. Does not touch the socket so it may be run
+ *        on another thread while the session is otherwise left alone.
+ *
+ * @param  session      The ssh server session.
+ * @return SSH_OK on success, SSH_ERROR otherwise.
+ */
+LIBSSH_API int ssh_server_kex_compute(ssh_session session);
+
+/**
+ * @brief Send the KEXDH_REPLY and NEWKEYS computed by
+ *        ssh_server_kex_compute().
+ *
+ * @param  session      The ssh server session.
+ * @return SSH_OK on success, SSH_ERROR otherwise.
+ */
+LIBSSH_API int ssh_server_kex_reply(ssh_session session);
+
+/**
+ * @brief Turn away a freshly accepted session without starting the key
+ *        exchange: our banner is sent so the client knows who it reached,
+ *        then the socket is closed. The session should then be freed.
+ *
+ * @param  session      The accepted ssh server session.
+ * @return SSH_OK if the banner was written, SSH_ERROR otherwise.
+ */
+LIBSSH_API int ssh_server_reject(ssh_session session);
+
+/* ephemeral keypair types, one per key exchange algorithm */
+enum ssh_kex_keypair_type_e {
+  SSH_KEX_KEYPAIR_DH_GROUP1=1,
+  SSH_KEX_KEYPAIR_DH_GROUP14,
+  SSH_KEX_KEYPAIR_ECDH_NISTP256,
+  SSH_KEX_KEYPAIR_CURVE25519
+};
+
+typedef struct ssh_kex_keypair_struct* ssh_kex_keypair;
+
+/**
+ * @brief Called when a server key exchange needs an ephemeral keypair.
+ *
+ * Return a keypair made with ssh_kex_keypair_new() for the given
+ * ssh_kex_keypair_type_e, ownership passes to the session, or NULL to
+ * have one generated inline. May be called from whichever thread runs
+ * ssh_server_kex_compute().
+ */
+typedef ssh_kex_keypair (*ssh_kex_keypair_callback) (ssh_session session,
+    int type, void *userdata);
+
+/**
+ * @brief Generate an ephemeral server keypair ahead of a key exchange, for
+ *        example on an idle thread. Doesn't need a session.
+ *
+ * @param  type         One of ssh_kex_keypair_type_e.
+ * @return The keypair, or NULL on error or if the type isn't supported.
+ */
+LIBSSH_API ssh_kex_keypair ssh_kex_keypair_new(int type);
+
+/**
+ * @brief Free a keypair that was never handed to a session.
+ *
+ * @param  keypair      The keypair to free.
+ */
+LIBSSH_API void ssh_kex_keypair_free(ssh_kex_keypair keypair);
+
+/**
+ * @brief Have the session ask for pregenerated ephemeral keypairs rather
+ *        than generating one in the middle of the key exchange.
+ *
+ * @param  session      The ssh server session.
+ * @param  cb           The callback, or NULL to always generate inline
+ *                      (default).
+ * @param  userdata     Passed through to the callback.
+ */
+LIBSSH_API void ssh_set_kex_keypair_callback(ssh_session session,
+    ssh_kex_keypair_callback cb, void *userdata);
+
 /**
  * @brief Free a ssh servers bind.
  *
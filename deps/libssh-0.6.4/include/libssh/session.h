@@ -46,6 +46,7 @@ enum ssh_session_state_e {
 enum ssh_dh_state_e {
   DH_STATE_INIT=0,
   DH_STATE_INIT_SENT,
+  DH_STATE_REPLY_PENDING,
   DH_STATE_NEWKEYS_SENT,
   DH_STATE_FINISHED
 };
@@ -150,6 +151,16 @@ struct ssh_session_struct {
 
         /* The type of host key wanted by client */
         enum ssh_keytypes_e hostkey;
+
+        /* kex reply computed by ssh_server_kex_compute() */
+        ssh_string kex_reply_pubkey;
+        ssh_string kex_reply_sig;
+        void (*kex_offload_function)(struct ssh_session_struct *session,
+            void *userdata);
+        void *kex_offload_userdata;
+        struct ssh_kex_keypair_struct *(*kex_keypair_function)(
+            struct ssh_session_struct *session, int type, void *userdata);
+        void *kex_keypair_userdata;
     } srv;
     /* auths accepted by server */
     int auth_methods;
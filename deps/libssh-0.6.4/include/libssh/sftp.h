@@ -84,6 +84,9 @@ struct sftp_session_struct {
     int errnum;
     void **handles;
     sftp_ext ext;
+    /* copy each client message for sftp_send_client_message(), off by
+     * default as nothing else needs it */
+    int keep_complete_message;
 };
 
 struct sftp_packet_struct {
@@ -820,6 +823,16 @@ LIBSSH_API int sftp_server_version(sftp_session sftp);
  */
 LIBSSH_API sftp_session sftp_server_new(ssh_session session, ssh_channel chan);
 
+/**
+ * @brief Keep a copy of each client message so it can be resent with
+ *        sftp_send_client_message(), e.g. when proxying.
+ *
+ * @param sftp          The sftp server session.
+ *
+ * @param keep          Non-zero to keep the copies.
+ */
+LIBSSH_API void sftp_server_keep_complete_message(sftp_session sftp, int keep);
+
 /**
  * @brief Intialize the sftp server.
  *
@@ -113,6 +113,28 @@ static socket_t bind_socket(ssh_bind sshbind, const char *hostname,
         return -1;
     }
 
+    if (sshbind->reuseport) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+                       (char *)&opt, sizeof(opt)) < 0) {
+            ssh_set_error(sshbind,
+                          SSH_FATAL,
+                          "Setting SO_REUSEPORT failed: %s",
+                          strerror(errno));
+            freeaddrinfo (ai);
+            close(s);
+            return -1;
+        }
+#else
+        ssh_set_error(sshbind,
+                      SSH_FATAL,
+                      "SO_REUSEPORT is not supported on this platform");
+        freeaddrinfo (ai);
+        close(s);
+        return -1;
+#endif
+    }
+
     if (bind(s, ai->ai_addr, ai->ai_addrlen) != 0) {
         ssh_set_error(sshbind,
                       SSH_FATAL,
@@ -225,6 +247,36 @@ static int ssh_bind_import_keys(ssh_bind sshbind) {
   return SSH_OK;
 }
 
+int ssh_bind_reload_keys(ssh_bind sshbind) {
+  ssh_key ecdsa = sshbind->ecdsa;
+  ssh_key dsa = sshbind->dsa;
+  ssh_key rsa = sshbind->rsa;
+  int rc;
+
+  sshbind->ecdsa = NULL;
+  sshbind->dsa = NULL;
+  sshbind->rsa = NULL;
+
+  rc = ssh_bind_import_keys(sshbind);
+  if (rc != SSH_OK) {
+    /* keep serving the old keys */
+    ssh_key_free(sshbind->ecdsa);
+    ssh_key_free(sshbind->dsa);
+    ssh_key_free(sshbind->rsa);
+    sshbind->ecdsa = ecdsa;
+    sshbind->dsa = dsa;
+    sshbind->rsa = rsa;
+    return SSH_ERROR;
+  }
+
+  /* sessions accepted before now hold their own references */
+  ssh_key_free(ecdsa);
+  ssh_key_free(dsa);
+  ssh_key_free(rsa);
+
+  return SSH_OK;
+}
+
 int ssh_bind_listen(ssh_bind sshbind) {
   const char *host;
   socket_t fd;
@@ -255,7 +307,7 @@ int ssh_bind_listen(ssh_bind sshbind) {
           return -1;
       }
 
-      if (listen(fd, 10) < 0) {
+      if (listen(fd, SOMAXCONN) < 0) {
           ssh_set_error(sshbind, SSH_FATAL,
                   "Listening to socket %d: %s",
                   fd, strerror(errno));
@@ -267,6 +319,10 @@ int ssh_bind_listen(ssh_bind sshbind) {
           return -1;
       }
 
+      if (!sshbind->blocking) {
+          ssh_socket_set_nonblocking(fd);
+      }
+
       sshbind->bindfd = fd;
   } else {
       SSH_LOG(SSH_LOG_INFO, "Using app-provided bind socket");
@@ -328,6 +384,13 @@ ssh_poll_handle ssh_bind_get_poll(ssh_bind sshbind){
 
 void ssh_bind_set_blocking(ssh_bind sshbind, int blocking) {
   sshbind->blocking = blocking ? 1 : 0;
+  if (sshbind->bindfd != SSH_INVALID_SOCKET) {
+    if (sshbind->blocking) {
+      ssh_socket_set_blocking(sshbind->bindfd);
+    } else {
+      ssh_socket_set_nonblocking(sshbind->bindfd);
+    }
+  }
 }
 
 socket_t ssh_bind_get_fd(ssh_bind sshbind) {
@@ -436,28 +499,19 @@ int ssh_bind_accept_fd(ssh_bind sshbind, ssh_session session, socket_t fd){
       return SSH_ERROR;
     }
 
+    /* the host keys are never modified once imported so every session
+     * shares the bind's copy, ssh_bind_reload_keys() only drops the
+     * bind's reference to the old ones */
 #ifdef HAVE_ECC
     if (sshbind->ecdsa) {
-        session->srv.ecdsa_key = ssh_key_dup(sshbind->ecdsa);
-        if (session->srv.ecdsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.ecdsa_key = ssh_key_ref(sshbind->ecdsa);
     }
 #endif
     if (sshbind->dsa) {
-        session->srv.dsa_key = ssh_key_dup(sshbind->dsa);
-        if (session->srv.dsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.dsa_key = ssh_key_ref(sshbind->dsa);
     }
     if (sshbind->rsa) {
-        session->srv.rsa_key = ssh_key_dup(sshbind->rsa);
-        if (session->srv.rsa_key == NULL) {
-          ssh_set_error_oom(sshbind);
-          return SSH_ERROR;
-        }
+        session->srv.rsa_key = ssh_key_ref(sshbind->rsa);
     }
     /* force PRNG to change state in case we fork after ssh_bind_accept */
     ssh_reseed();
@@ -480,6 +534,16 @@ int ssh_bind_accept(ssh_bind sshbind, ssh_session session) {
 
   fd = accept(sshbind->bindfd, NULL, NULL);
   if (fd == SSH_INVALID_SOCKET) {
+    /* nothing left in the listen queue, the session is untouched */
+#ifdef _WIN32
+    if (WSAGetLastError() == WSAEWOULDBLOCK) {
+      return SSH_AGAIN;
+    }
+#else
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return SSH_AGAIN;
+    }
+#endif
     ssh_set_error(sshbind, SSH_FATAL,
         "Accepting a new connection: %s",
         strerror(errno));
@@ -494,6 +558,7 @@ int ssh_bind_accept(ssh_bind sshbind, ssh_session session) {
       close(fd);
 #endif
       ssh_socket_free(session->socket);
+      session->socket = NULL;
   }
   return rc;
 }
@@ -467,6 +467,14 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
 
   channel->remote_window += bytes;
 
+  if (bytes > 0 &&
+      ssh_callbacks_exists(channel->callbacks, channel_write_wontblock_function)) {
+    channel->callbacks->channel_write_wontblock_function(channel->session,
+                                                         channel,
+                                                         channel->remote_window,
+                                                         channel->callbacks->userdata);
+  }
+
   return SSH_PACKET_USED;
 }
 
@@ -1437,6 +1445,25 @@ int ssh_channel_is_open(ssh_channel channel) {
     return (channel->state == SSH_CHANNEL_STATE_OPEN && channel->session->alive != 0);
 }
 
+/**
+ * @brief Check if the channel is still waiting for the other side to
+ *        answer its open request.
+ *
+ * Packets aren't read here, whatever processes the session's packets
+ * brings the answer in. Once this returns 0 the channel is either open,
+ * see ssh_channel_is_open(), or was refused.
+ *
+ * @param[in]  channel  The channel to check.
+ *
+ * @return              nonzero while the open is pending, 0 otherwise.
+ */
+int ssh_channel_is_opening(ssh_channel channel) {
+    if(channel == NULL) {
+        return 0;
+    }
+    return (channel->state == SSH_CHANNEL_STATE_OPENING && channel->session->alive != 0);
+}
+
 /**
  * @brief Check if the channel is closed or not.
  *
@@ -2818,8 +2845,9 @@ int ssh_channel_read_timeout(ssh_channel channel,
   len = (len > count ? count : len);
   memcpy(dest, buffer_get_rest(stdbuf), len);
   buffer_pass_bytes(stdbuf,len);
-  /* Authorize some buffering while userapp is busy */
-  if (channel->local_window < WINDOWLIMIT) {
+  /* Authorize some buffering while userapp is busy, counting what it has
+   * yet to read so a reader that stops reading stops the window growing */
+  if (channel->local_window + buffer_get_rest_len(stdbuf) < WINDOWLIMIT) {
     if (grow_window(session, channel, 0) < 0) {
       return -1;
     }
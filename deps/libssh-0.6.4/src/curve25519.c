@@ -37,6 +37,7 @@
 #include "libssh/crypto.h"
 #include "libssh/dh.h"
 #include "libssh/pki.h"
+#include "libssh/server.h"
 
 /** @internal
  * @brief Starts curve25519-sha256@libssh.org key exchange
@@ -166,14 +167,7 @@ error:
  * SSH_MSG_KEXDH_REPLY
  */
 int ssh_server_curve25519_init(ssh_session session, ssh_buffer packet){
-    /* ECDH keys */
     ssh_string q_c_string;
-    ssh_string q_s_string;
-
-    /* SSH host keys (rsa,dsa,ecdsa) */
-    ssh_key privkey;
-    ssh_string sig_blob = NULL;
-    int rc;
 
     /* Extract the client pubkey from the init packet */
     q_c_string = buffer_get_ssh_string(packet);
@@ -191,100 +185,91 @@ int ssh_server_curve25519_init(ssh_session session, ssh_buffer packet){
     memcpy(session->next_crypto->curve25519_client_pubkey,
     		ssh_string_data(q_c_string), CURVE25519_PUBKEY_SIZE);
     ssh_string_free(q_c_string);
-    /* Build server's keypair */
 
-    rc = ssh_get_random(session->next_crypto->curve25519_privkey, CURVE25519_PRIVKEY_SIZE, 1);
-    if (rc == 0){
-        ssh_set_error(session, SSH_FATAL, "PRNG error");
+    return ssh_server_kex_continue(session);
+}
+
+/** @internal
+ * @brief generates a server curve25519 keypair
+ */
+int ssh_curve25519_generate_keypair(ssh_curve25519_privkey privkey,
+                                    ssh_curve25519_pubkey pubkey){
+    if (ssh_get_random(privkey, CURVE25519_PRIVKEY_SIZE, 1) == 0) {
         return SSH_ERROR;
     }
 
-    crypto_scalarmult_base(session->next_crypto->curve25519_server_pubkey,
-  		  session->next_crypto->curve25519_privkey);
+    crypto_scalarmult_base(pubkey, privkey);
 
-    rc = buffer_add_u8(session->out_buffer, SSH2_MSG_KEX_ECDH_REPLY);
-    if (rc < 0) {
-        ssh_set_error_oom(session);
-        goto error;
+    return SSH_OK;
+}
+
+/** @internal
+ * @brief Build the server's Curve25519 keypair, k, the session id and its
+ * signature. The reply itself is sent by ssh_server_kex_reply().
+ */
+int ssh_server_curve25519_compute(ssh_session session){
+    /* SSH host keys (rsa,dsa,ecdsa) */
+    ssh_key privkey;
+    ssh_kex_keypair keypair;
+    int rc;
+
+    /* Build server's keypair, or use a pregenerated one */
+
+    keypair = ssh_server_kex_keypair(session);
+    if (keypair != NULL) {
+        memcpy(session->next_crypto->curve25519_privkey,
+               keypair->curve25519_privkey, CURVE25519_PRIVKEY_SIZE);
+        memcpy(session->next_crypto->curve25519_server_pubkey,
+               keypair->curve25519_pubkey, CURVE25519_PUBKEY_SIZE);
+        ssh_kex_keypair_free(keypair);
+    } else {
+        rc = ssh_curve25519_generate_keypair(
+                session->next_crypto->curve25519_privkey,
+                session->next_crypto->curve25519_server_pubkey);
+        if (rc != SSH_OK) {
+            ssh_set_error(session, SSH_FATAL, "PRNG error");
+            return SSH_ERROR;
+        }
     }
 
     /* build k and session_id */
     rc = ssh_curve25519_build_k(session);
     if (rc < 0) {
         ssh_set_error(session, SSH_FATAL, "Cannot build k number");
-        goto error;
+        return SSH_ERROR;
     }
 
     /* privkey is not allocated */
     rc = ssh_get_key_params(session, &privkey);
     if (rc == SSH_ERROR) {
-        goto error;
+        return SSH_ERROR;
     }
 
     rc = make_sessionid(session);
     if (rc != SSH_OK) {
         ssh_set_error(session, SSH_FATAL, "Could not create a session id");
-        goto error;
+        return SSH_ERROR;
     }
 
-    /* add host's public key */
-    rc = buffer_add_ssh_string(session->out_buffer,
-                               session->next_crypto->server_pubkey);
-    if (rc < 0) {
+    /* ecdh public key */
+    session->srv.kex_reply_pubkey = ssh_string_new(CURVE25519_PUBKEY_SIZE);
+    if (session->srv.kex_reply_pubkey == NULL) {
         ssh_set_error_oom(session);
-        goto error;
-    }
-
-    /* add ecdh public key */
-    q_s_string = ssh_string_new(CURVE25519_PUBKEY_SIZE);
-    if (q_s_string == NULL) {
-        goto error;
+        return SSH_ERROR;
     }
 
-    ssh_string_fill(q_s_string,
+    ssh_string_fill(session->srv.kex_reply_pubkey,
                     session->next_crypto->curve25519_server_pubkey,
                     CURVE25519_PUBKEY_SIZE);
 
-    rc = buffer_add_ssh_string(session->out_buffer, q_s_string);
-    ssh_string_free(q_s_string);
-    if (rc < 0) {
-        ssh_set_error_oom(session);
-        goto error;
-    }
-    /* add signature blob */
-    sig_blob = ssh_srv_pki_do_sign_sessionid(session, privkey);
-    if (sig_blob == NULL) {
+    /* signature blob */
+    session->srv.kex_reply_sig = ssh_srv_pki_do_sign_sessionid(session, privkey);
+    if (session->srv.kex_reply_sig == NULL) {
         ssh_set_error(session, SSH_FATAL, "Could not sign the session id");
-        goto error;
-    }
-
-    rc = buffer_add_ssh_string(session->out_buffer, sig_blob);
-    ssh_string_free(sig_blob);
-    if (rc < 0) {
-        ssh_set_error_oom(session);
-        goto error;
-    }
-
-    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_KEX_ECDH_REPLY sent");
-    rc = packet_send(session);
-    if (rc == SSH_ERROR) {
         return SSH_ERROR;
     }
 
-    /* Send the MSG_NEWKEYS */
-    rc = buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS);
-    if (rc < 0) {
-        goto error;
-    }
-
-    session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
-    rc = packet_send(session);
-    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
-
-    return rc;
-error:
-    buffer_reinit(session->out_buffer);
-    return SSH_ERROR;
+    return SSH_OK;
 }
 
 #endif /* WITH_SERVER */
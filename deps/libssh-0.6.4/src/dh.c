@@ -280,6 +280,37 @@ int dh_generate_y(ssh_session session) {
   return 0;
 }
 
+/* used by server, makes a y and f = g^y mod p ahead of time for a later
+ * key exchange of the given type */
+int dh_generate_keypair(enum ssh_key_exchange_e type, bignum *y, bignum *f) {
+#ifdef HAVE_LIBCRYPTO
+  bignum_CTX ctx = bignum_ctx_new();
+  if (ctx == NULL) {
+    return -1;
+  }
+#endif
+
+  *y = bignum_new();
+  *f = bignum_new();
+  if (*y == NULL || *f == NULL) {
+#ifdef HAVE_LIBCRYPTO
+    bignum_ctx_free(ctx);
+#endif
+    return -1;
+  }
+
+#ifdef HAVE_LIBGCRYPT
+  bignum_rand(*y, 128);
+  bignum_mod_exp(*f, g, *y, select_p(type));
+#elif defined HAVE_LIBCRYPTO
+  bignum_rand(*y, 128, 0, -1);
+  bignum_mod_exp(*f, g, *y, select_p(type), ctx);
+  bignum_ctx_free(ctx);
+#endif
+
+  return 0;
+}
+
 /* used by server */
 int dh_generate_e(ssh_session session) {
 #ifdef HAVE_LIBCRYPTO
@@ -26,6 +26,7 @@
 #include "libssh/buffer.h"
 #include "libssh/ssh2.h"
 #include "libssh/pki.h"
+#include "libssh/server.h"
 
 #ifdef HAVE_ECDH
 #include <openssl/ecdh.h>
@@ -214,18 +215,7 @@ error:
  */
 
 int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
-    /* ECDH keys */
     ssh_string q_c_string;
-    ssh_string q_s_string;
-    EC_KEY *ecdh_key;
-    const EC_GROUP *group;
-    const EC_POINT *ecdh_pubkey;
-    bignum_CTX ctx;
-    /* SSH host keys (rsa,dsa,ecdsa) */
-    ssh_key privkey;
-    ssh_string sig_blob = NULL;
-    int len;
-    int rc;
 
     /* Extract the client pubkey from the init packet */
     q_c_string = buffer_get_ssh_string(packet);
@@ -235,12 +225,23 @@ int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
     }
     session->next_crypto->ecdh_client_pubkey = q_c_string;
 
-    /* Build server's keypair */
+    return ssh_server_kex_continue(session);
+}
+
+/** @internal
+ * @brief generates a server ECDH keypair and its Q_S octet string
+ */
+int ecdh_generate_keypair(EC_KEY **key, ssh_string *pubkey){
+    ssh_string q_s_string;
+    EC_KEY *ecdh_key;
+    const EC_GROUP *group;
+    const EC_POINT *ecdh_pubkey;
+    bignum_CTX ctx;
+    int len;
 
     ctx = BN_CTX_new();
     ecdh_key = EC_KEY_new_by_curve_name(NISTP256);
     if (ecdh_key == NULL) {
-        ssh_set_error_oom(session);
         BN_CTX_free(ctx);
         return SSH_ERROR;
     }
@@ -271,15 +272,42 @@ int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
                        ctx);
     BN_CTX_free(ctx);
 
-    session->next_crypto->ecdh_privkey = ecdh_key;
-    session->next_crypto->ecdh_server_pubkey = q_s_string;
+    *key = ecdh_key;
+    *pubkey = q_s_string;
 
-    rc = buffer_add_u8(session->out_buffer, SSH2_MSG_KEXDH_REPLY);
-    if (rc < 0) {
+    return SSH_OK;
+}
+
+/** @internal
+ * @brief Build the server's ECDH keypair, k, the session id and its
+ * signature. The reply itself is sent by ssh_server_kex_reply().
+ */
+int ssh_server_ecdh_compute(ssh_session session){
+    /* ECDH keys */
+    ssh_string q_s_string;
+    EC_KEY *ecdh_key;
+    ssh_kex_keypair keypair;
+    /* SSH host keys (rsa,dsa,ecdsa) */
+    ssh_key privkey;
+    int rc;
+
+    /* Build server's keypair, or use a pregenerated one */
+
+    keypair = ssh_server_kex_keypair(session);
+    if (keypair != NULL) {
+        ecdh_key = keypair->ecdh_privkey;
+        q_s_string = keypair->ecdh_pubkey;
+        keypair->ecdh_privkey = NULL;
+        keypair->ecdh_pubkey = NULL;
+        ssh_kex_keypair_free(keypair);
+    } else if (ecdh_generate_keypair(&ecdh_key, &q_s_string) != SSH_OK) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
     }
 
+    session->next_crypto->ecdh_privkey = ecdh_key;
+    session->next_crypto->ecdh_server_pubkey = q_s_string;
+
     /* build k and session_id */
     rc = ecdh_build_k(session);
     if (rc < 0) {
@@ -299,51 +327,21 @@ int ssh_server_ecdh_init(ssh_session session, ssh_buffer packet){
         return SSH_ERROR;
     }
 
-    /* add host's public key */
-    rc = buffer_add_ssh_string(session->out_buffer,
-                               session->next_crypto->server_pubkey);
-    if (rc < 0) {
+    /* ecdh public key */
+    session->srv.kex_reply_pubkey = ssh_string_copy(q_s_string);
+    if (session->srv.kex_reply_pubkey == NULL) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
     }
 
-    /* add ecdh public key */
-    rc = buffer_add_ssh_string(session->out_buffer, q_s_string);
-    if (rc < 0) {
-        ssh_set_error_oom(session);
-        return SSH_ERROR;
-    }
-    /* add signature blob */
-    sig_blob = ssh_srv_pki_do_sign_sessionid(session, privkey);
-    if (sig_blob == NULL) {
+    /* signature blob */
+    session->srv.kex_reply_sig = ssh_srv_pki_do_sign_sessionid(session, privkey);
+    if (session->srv.kex_reply_sig == NULL) {
         ssh_set_error(session, SSH_FATAL, "Could not sign the session id");
         return SSH_ERROR;
     }
 
-    rc = buffer_add_ssh_string(session->out_buffer, sig_blob);
-    ssh_string_free(sig_blob);
-    if (rc < 0) {
-        ssh_set_error_oom(session);
-        return SSH_ERROR;
-    }
-
-    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_KEXDH_REPLY sent");
-    rc = packet_send(session);
-    if (rc == SSH_ERROR) {
-        return SSH_ERROR;
-    }
-
-    /* Send the MSG_NEWKEYS */
-    rc = buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS);
-    if (rc < 0) {
-        return SSH_ERROR;;
-    }
-
-    session->dh_handshake_state = DH_STATE_NEWKEYS_SENT;
-    rc = packet_send(session);
-    SSH_LOG(SSH_LOG_PROTOCOL, "SSH_MSG_NEWKEYS sent");
-
-    return rc;
+    return SSH_OK;
 }
 
 #endif /* WITH_SERVER */
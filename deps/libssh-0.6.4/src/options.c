@@ -1379,6 +1379,11 @@ static int ssh_bind_set_key(ssh_bind sshbind, char **key_loc,
  *                      - SSH_BIND_OPTIONS_BANNER:
  *                        Set the server banner sent to clients (const char *).
  *
+ *                      - SSH_BIND_OPTIONS_REUSEPORT:
+ *                        Set SO_REUSEPORT on the listening socket so
+ *                        several processes can bind the same address
+ *                        and port (int *, 0 to disable).
+ *
  * @param  value        The value to set. This is a generic pointer and the
  *                      datatype which should be used is described at the
  *                      corresponding value of type above.
@@ -1502,6 +1507,15 @@ int ssh_bind_options_set(ssh_bind sshbind, enum ssh_bind_options_e type,
         }
       }
       break;
+    case SSH_BIND_OPTIONS_REUSEPORT:
+      if (value == NULL) {
+        ssh_set_error_invalid(sshbind);
+        return -1;
+      } else {
+        int *x = (int *) value;
+        sshbind->reuseport = *x ? 1 : 0;
+      }
+      break;
     default:
       ssh_set_error(sshbind, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
       return -1;
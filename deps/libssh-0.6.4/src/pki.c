@@ -139,6 +139,23 @@ ssh_key ssh_key_dup(const ssh_key key)
     return pki_key_dup(key, 0);
 }
 
+/**
+ * @brief take a reference to a key instead of duplicating it, each
+ * reference is released with ssh_key_free(). The key must not be
+ * modified while it is shared.
+ * @param[in] key ssh_key to reference
+ * @returns the same key
+ */
+ssh_key ssh_key_ref(ssh_key key)
+{
+    if (key == NULL) {
+        return NULL;
+    }
+
+    key->refcount++;
+    return key;
+}
+
 /**
  * @brief clean up the key and deallocate all existing keys
  * @param[in] key ssh_key to clean
@@ -172,6 +189,10 @@ void ssh_key_clean (ssh_key key){
  */
 void ssh_key_free (ssh_key key){
     if(key){
+        if (key->refcount > 0) {
+            key->refcount--;
+            return;
+        }
         ssh_key_clean(key);
         SAFE_FREE(key);
     }
@@ -65,7 +65,7 @@
             session->common.callbacks->connect_status_function(session->common.callbacks->userdata, status); \
     } while (0)
 
-static int dh_handshake_server(ssh_session session);
+static int ssh_server_dh_compute(ssh_session session);
 
 
 /**
@@ -148,6 +148,7 @@ static int server_set_kex(ssh_session session) {
  **/
 static int ssh_server_kexdh_init(ssh_session session, ssh_buffer packet){
     ssh_string e;
+    int rc = SSH_OK;
     e = buffer_get_ssh_string(packet);
     if (e == NULL) {
       ssh_set_error(session, SSH_FATAL, "No e number in client request");
@@ -158,10 +159,10 @@ static int ssh_server_kexdh_init(ssh_session session, ssh_buffer packet){
       session->session_state=SSH_SESSION_STATE_ERROR;
     } else {
       session->dh_handshake_state=DH_STATE_INIT_SENT;
-      dh_handshake_server(session);
+      rc = ssh_server_kex_continue(session);
     }
     ssh_string_free(e);
-    return SSH_OK;
+    return rc;
 }
 
 SSH_PACKET_CALLBACK(ssh_packet_kexdh_init){
@@ -240,82 +241,305 @@ int ssh_get_key_params(ssh_session session, ssh_key *privkey){
     return SSH_OK;
 }
 
-static int dh_handshake_server(ssh_session session) {
+static int ssh_server_dh_compute(ssh_session session) {
   ssh_key privkey;
-  //ssh_string pubkey_blob = NULL;
-  ssh_string sig_blob;
-  ssh_string f;
-
-  if (dh_generate_y(session) < 0) {
-    ssh_set_error(session, SSH_FATAL, "Could not create y number");
-    return -1;
-  }
-  if (dh_generate_f(session) < 0) {
-    ssh_set_error(session, SSH_FATAL, "Could not create f number");
-    return -1;
+  ssh_kex_keypair keypair;
+
+  keypair = ssh_server_kex_keypair(session);
+  if (keypair != NULL) {
+    session->next_crypto->y = keypair->y;
+    session->next_crypto->f = keypair->f;
+    keypair->y = NULL;
+    keypair->f = NULL;
+    ssh_kex_keypair_free(keypair);
+  } else {
+    if (dh_generate_y(session) < 0) {
+      ssh_set_error(session, SSH_FATAL, "Could not create y number");
+      return -1;
+    }
+    if (dh_generate_f(session) < 0) {
+      ssh_set_error(session, SSH_FATAL, "Could not create f number");
+      return -1;
+    }
   }
 
-  f = dh_get_f(session);
-  if (f == NULL) {
+  session->srv.kex_reply_pubkey = dh_get_f(session);
+  if (session->srv.kex_reply_pubkey == NULL) {
     ssh_set_error(session, SSH_FATAL, "Could not get the f number");
     return -1;
   }
 
   if (ssh_get_key_params(session,&privkey) != SSH_OK){
-      ssh_string_free(f);
       return -1;
   }
 
   if (dh_build_k(session) < 0) {
     ssh_set_error(session, SSH_FATAL, "Could not import the public key");
-    ssh_string_free(f);
     return -1;
   }
 
   if (make_sessionid(session) != SSH_OK) {
     ssh_set_error(session, SSH_FATAL, "Could not create a session id");
-    ssh_string_free(f);
     return -1;
   }
 
-  sig_blob = ssh_srv_pki_do_sign_sessionid(session, privkey);
-  if (sig_blob == NULL) {
+  session->srv.kex_reply_sig = ssh_srv_pki_do_sign_sessionid(session, privkey);
+  if (session->srv.kex_reply_sig == NULL) {
     ssh_set_error(session, SSH_FATAL, "Could not sign the session id");
-    ssh_string_free(f);
     return -1;
   }
 
+  return 0;
+}
+
+int ssh_server_kex_compute(ssh_session session) {
+  int rc;
+
+  switch(session->next_crypto->kex_type){
+      case SSH_KEX_DH_GROUP1_SHA1:
+      case SSH_KEX_DH_GROUP14_SHA1:
+        rc = ssh_server_dh_compute(session);
+        break;
+  #ifdef HAVE_ECDH
+      case SSH_KEX_ECDH_SHA2_NISTP256:
+        rc = ssh_server_ecdh_compute(session);
+        break;
+  #endif
+  #ifdef HAVE_CURVE25519
+      case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+        rc = ssh_server_curve25519_compute(session);
+        break;
+  #endif
+      default:
+        ssh_set_error(session,SSH_FATAL,"Wrong kex type in ssh_server_kex_compute");
+        rc = SSH_ERROR;
+  }
+
+  if (rc < 0) {
+    ssh_string_free(session->srv.kex_reply_pubkey);
+    session->srv.kex_reply_pubkey = NULL;
+    ssh_string_free(session->srv.kex_reply_sig);
+    session->srv.kex_reply_sig = NULL;
+    return SSH_ERROR;
+  }
+
+  return SSH_OK;
+}
+
+int ssh_server_kex_reply(ssh_session session) {
+  /* SSH2_MSG_KEX_ECDH_REPLY shares its number with SSH2_MSG_KEXDH_REPLY */
+  if (session->srv.kex_reply_pubkey == NULL ||
+      session->srv.kex_reply_sig == NULL) {
+    goto error;
+  }
+
   if (buffer_add_u8(session->out_buffer, SSH2_MSG_KEXDH_REPLY) < 0 ||
       buffer_add_ssh_string(session->out_buffer,
               session->next_crypto->server_pubkey) < 0 ||
-      buffer_add_ssh_string(session->out_buffer, f) < 0 ||
-      buffer_add_ssh_string(session->out_buffer, sig_blob) < 0) {
+      buffer_add_ssh_string(session->out_buffer,
+              session->srv.kex_reply_pubkey) < 0 ||
+      buffer_add_ssh_string(session->out_buffer,
+              session->srv.kex_reply_sig) < 0) {
     ssh_set_error(session, SSH_FATAL, "Not enough space");
     buffer_reinit(session->out_buffer);
-    ssh_string_free(f);
-    ssh_string_free(sig_blob);
-    return -1;
+    goto error;
   }
-  ssh_string_free(f);
-  ssh_string_free(sig_blob);
+  ssh_string_free(session->srv.kex_reply_pubkey);
+  session->srv.kex_reply_pubkey = NULL;
+  ssh_string_free(session->srv.kex_reply_sig);
+  session->srv.kex_reply_sig = NULL;
   if (packet_send(session) == SSH_ERROR) {
-    return -1;
+    goto error;
   }
+  SSH_LOG(SSH_LOG_PACKET, "SSH_MSG_KEXDH_REPLY sent");
 
   if (buffer_add_u8(session->out_buffer, SSH2_MSG_NEWKEYS) < 0) {
     buffer_reinit(session->out_buffer);
-    return -1;
+    goto error;
   }
 
+  session->dh_handshake_state=DH_STATE_NEWKEYS_SENT;
   if (packet_send(session) == SSH_ERROR) {
-    return -1;
+    goto error;
   }
   SSH_LOG(SSH_LOG_PACKET, "SSH_MSG_NEWKEYS sent");
-  session->dh_handshake_state=DH_STATE_NEWKEYS_SENT;
 
+  return SSH_OK;
+error:
+  ssh_string_free(session->srv.kex_reply_pubkey);
+  session->srv.kex_reply_pubkey = NULL;
+  ssh_string_free(session->srv.kex_reply_sig);
+  session->srv.kex_reply_sig = NULL;
+  session->session_state = SSH_SESSION_STATE_ERROR;
+  return SSH_ERROR;
+}
+
+int ssh_server_reject(ssh_session session) {
+  int rc;
+
+  if (session == NULL || session->socket == NULL) {
+    return SSH_ERROR;
+  }
+
+  rc = ssh_send_banner(session, 1);
+  ssh_socket_close(session->socket);
+  session->alive = 0;
+  session->session_state = SSH_SESSION_STATE_DISCONNECTED;
+
+  return rc < 0 ? SSH_ERROR : SSH_OK;
+}
+
+/** @internal
+ * @brief Called once the client's kex init has been imported, either
+ *        computes and sends the reply straight away or hands the session
+ *        to the kex offload callback to do it later.
+ */
+int ssh_server_kex_continue(ssh_session session) {
+  if (session->srv.kex_offload_function != NULL) {
+    session->dh_handshake_state = DH_STATE_REPLY_PENDING;
+    session->srv.kex_offload_function(session,
+        session->srv.kex_offload_userdata);
+    return SSH_OK;
+  }
+
+  if (ssh_server_kex_compute(session) != SSH_OK) {
+    return SSH_ERROR;
+  }
+
+  return ssh_server_kex_reply(session);
+}
+
+void ssh_set_kex_offload_callback(ssh_session session,
+    ssh_kex_offload_callback cb, void *userdata) {
+  if (session == NULL) {
+    return;
+  }
+  session->srv.kex_offload_function = cb;
+  session->srv.kex_offload_userdata = userdata;
+}
+
+/* the public keypair types and the kex algorithms they're for */
+static enum ssh_key_exchange_e ssh_kex_keypair_kex(int type) {
+  switch (type) {
+    case SSH_KEX_KEYPAIR_DH_GROUP1:
+      return SSH_KEX_DH_GROUP1_SHA1;
+    case SSH_KEX_KEYPAIR_DH_GROUP14:
+      return SSH_KEX_DH_GROUP14_SHA1;
+    case SSH_KEX_KEYPAIR_ECDH_NISTP256:
+      return SSH_KEX_ECDH_SHA2_NISTP256;
+    case SSH_KEX_KEYPAIR_CURVE25519:
+      return SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG;
+  }
+  return 0;
+}
+
+static int ssh_kex_keypair_type(enum ssh_key_exchange_e kex) {
+  switch (kex) {
+    case SSH_KEX_DH_GROUP1_SHA1:
+      return SSH_KEX_KEYPAIR_DH_GROUP1;
+    case SSH_KEX_DH_GROUP14_SHA1:
+      return SSH_KEX_KEYPAIR_DH_GROUP14;
+    case SSH_KEX_ECDH_SHA2_NISTP256:
+      return SSH_KEX_KEYPAIR_ECDH_NISTP256;
+    case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+      return SSH_KEX_KEYPAIR_CURVE25519;
+  }
   return 0;
 }
 
+ssh_kex_keypair ssh_kex_keypair_new(int type) {
+  ssh_kex_keypair keypair;
+  int rc;
+
+  keypair = malloc(sizeof(struct ssh_kex_keypair_struct));
+  if (keypair == NULL) {
+    return NULL;
+  }
+  ZERO_STRUCTP(keypair);
+  keypair->type = ssh_kex_keypair_kex(type);
+
+  switch (keypair->type) {
+    case SSH_KEX_DH_GROUP1_SHA1:
+    case SSH_KEX_DH_GROUP14_SHA1:
+      rc = dh_generate_keypair(keypair->type, &keypair->y, &keypair->f);
+      break;
+#ifdef HAVE_ECDH
+    case SSH_KEX_ECDH_SHA2_NISTP256:
+      rc = ecdh_generate_keypair(&keypair->ecdh_privkey,
+                                 &keypair->ecdh_pubkey);
+      break;
+#endif
+#ifdef HAVE_CURVE25519
+    case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+      rc = ssh_curve25519_generate_keypair(keypair->curve25519_privkey,
+                                           keypair->curve25519_pubkey);
+      break;
+#endif
+    default:
+      rc = SSH_ERROR;
+  }
+
+  if (rc < 0) {
+    ssh_kex_keypair_free(keypair);
+    return NULL;
+  }
+
+  return keypair;
+}
+
+void ssh_kex_keypair_free(ssh_kex_keypair keypair) {
+  if (keypair == NULL) {
+    return;
+  }
+
+  if (keypair->y != NULL) {
+    bignum_free(keypair->y);
+  }
+  if (keypair->f != NULL) {
+    bignum_free(keypair->f);
+  }
+#ifdef HAVE_ECDH
+  if (keypair->ecdh_privkey != NULL) {
+    EC_KEY_free(keypair->ecdh_privkey);
+  }
+  ssh_string_free(keypair->ecdh_pubkey);
+#endif
+
+  BURN_BUFFER(keypair, sizeof(struct ssh_kex_keypair_struct));
+  SAFE_FREE(keypair);
+}
+
+void ssh_set_kex_keypair_callback(ssh_session session,
+    ssh_kex_keypair_callback cb, void *userdata) {
+  if (session == NULL) {
+    return;
+  }
+  session->srv.kex_keypair_function = cb;
+  session->srv.kex_keypair_userdata = userdata;
+}
+
+/** @internal
+ * @brief Takes a pregenerated ephemeral keypair for the session's kex from
+ *        the keypair callback, NULL if the caller should generate its own.
+ */
+ssh_kex_keypair ssh_server_kex_keypair(ssh_session session) {
+  ssh_kex_keypair keypair;
+
+  if (session->srv.kex_keypair_function == NULL) {
+    return NULL;
+  }
+
+  keypair = session->srv.kex_keypair_function(session,
+      ssh_kex_keypair_type(session->next_crypto->kex_type),
+      session->srv.kex_keypair_userdata);
+  if (keypair != NULL && keypair->type != session->next_crypto->kex_type) {
+    ssh_kex_keypair_free(keypair);
+    return NULL;
+  }
+
+  return keypair;
+}
+
 /**
  * @internal
  *
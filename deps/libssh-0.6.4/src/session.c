@@ -231,6 +231,10 @@ void ssh_free(ssh_session session) {
   session->srv.rsa_key = NULL;
   ssh_key_free(session->srv.ecdsa_key);
   session->srv.ecdsa_key = NULL;
+  ssh_string_free(session->srv.kex_reply_pubkey);
+  session->srv.kex_reply_pubkey = NULL;
+  ssh_string_free(session->srv.kex_reply_sig);
+  session->srv.kex_reply_sig = NULL;
 
   if (session->ssh_message_list) {
       ssh_message msg;
@@ -683,6 +687,26 @@ int ssh_get_poll_flags(ssh_session session)
   return ssh_socket_get_poll_flags (session->socket);
 }
 
+/**
+ * @brief Write out buffered data for an external mainloop that has seen the
+ *        session's socket become writable.
+ *
+ * @param session       The ssh session to use.
+ *
+ * @returns SSH_OK if everything buffered has been written, SSH_AGAIN if
+ *          some is still waiting for the socket (see ssh_get_poll_flags())
+ *          or SSH_ERROR on error.
+ */
+int ssh_nonblocking_flush(ssh_session session)
+{
+  if (session == NULL || session->socket == NULL) {
+    return SSH_ERROR;
+  }
+
+  ssh_socket_set_write_wontblock(session->socket);
+  return ssh_socket_nonblocking_flush(session->socket);
+}
+
 /**
  * @brief Get the disconnect message from the server.
  *
@@ -193,6 +193,10 @@ sftp_session sftp_server_new(ssh_session session, ssh_channel chan){
   return sftp;
 }
 
+void sftp_server_keep_complete_message(sftp_session sftp, int keep){
+  sftp->keep_complete_message = keep;
+}
+
 int sftp_server_init(sftp_session sftp){
   ssh_session session = sftp->session;
   sftp_packet packet = NULL;
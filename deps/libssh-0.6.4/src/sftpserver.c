@@ -62,9 +62,11 @@ sftp_client_message sftp_get_client_message(sftp_session sftp) {
   msg->type = packet->type;
   msg->sftp = sftp;
 
-  /* take a copy of the whole packet */
-  msg->complete_message = ssh_buffer_new();
-  buffer_add_data(msg->complete_message, buffer_get_rest(payload), buffer_get_rest_len(payload));
+  /* take a copy of the whole packet, only if it may be resent */
+  if (sftp->keep_complete_message) {
+    msg->complete_message = ssh_buffer_new();
+    buffer_add_data(msg->complete_message, buffer_get_rest(payload), buffer_get_rest_len(payload));
+  }
 
   buffer_get_u32(payload, &msg->id);
 
@@ -247,6 +249,11 @@ sftp_client_message sftp_get_client_message(sftp_session sftp) {
 
 /* Send an sftp client message. Can be used in cas of proxying */
 int sftp_send_client_message(sftp_session sftp, sftp_client_message msg){
+	if (msg->complete_message == NULL) {
+		ssh_set_error(sftp->session, SSH_FATAL,
+			"sftp_server_keep_complete_message() wasn't set");
+		return -1;
+	}
 	return sftp_packet_write(sftp, msg->type, msg->complete_message);
 }
 
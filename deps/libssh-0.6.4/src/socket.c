@@ -738,7 +738,8 @@ int ssh_socket_get_poll_flags(ssh_socket s) {
   if (s->poll_in != NULL && (ssh_poll_get_events (s->poll_in) & POLLIN) > 0) {
     r |= SSH_READ_PENDING;
   }
-  if (s->poll_out != NULL && (ssh_poll_get_events (s->poll_out) & POLLOUT) > 0) {
+  /* POLLOUT is left on after every write, go by what's actually buffered */
+  if (buffer_get_rest_len(s->out_buffer) > 0) {
     r |= SSH_WRITE_PENDING;
   }
   return r;
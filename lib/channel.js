@@ -5,25 +5,35 @@ function Channel (server, channel) {
   this._channel = channel
   this._server  = server
 
-  channel.onMessage = function (message) {
-    if (this._server._options.debug)
-      console.log('channel message', message)
-    if (message.subtype && /^(exec|subsystem|shell|pty|env|windowchange)$/.test(message.subtype))
-      return this.emit(message.subtype, message)
-    // else handle default.. probably should pass this on
-    message.replyDefault()
-  }.bind(this)
-
-  channel.onSftpMessage = function (message) {
-    if (this._server._options.debug)
-      console.log('sftp message', message)
-    this.emit('sftp:' + message.type, message)
-    this.emit('sftpmessage', message)
-  }.bind(this)
-
-  channel.onData = this.push.bind(this)
-
-  channel.onClose = this.push.bind(this, null)
+  // held natively until the channel closes, no lookups per event
+  channel.setCallbacks({
+      onMessage: function (message) {
+        if (this._server._options.debug)
+          console.log('channel message', message)
+        if (message.subtype && /^(exec|subsystem|shell|pty|env|windowchange)$/.test(message.subtype))
+          return this.emit(message.subtype, message)
+        // else handle default.. probably should pass this on
+        message.replyDefault()
+      }.bind(this)
+
+    , onSftpMessage: function (message) {
+        if (this._server._options.debug)
+          console.log('sftp message', message)
+        this.emit('sftp:' + message.type, message)
+        this.emit('sftpmessage', message)
+      }.bind(this)
+
+      // data arrives as a slice of a slab shared between reads
+    , onData: function (slab, start, end) {
+        // stop reading until _read(), the client's window closes behind us
+        if (!this.push(slab.slice(start, end)))
+          this._channel.pause()
+      }.bind(this)
+
+    , onClose: this.push.bind(this, null)
+
+    , onExit: this.emit.bind(this, 'exit')
+  })
 
   stream.Duplex.call(this)
 
@@ -43,12 +53,48 @@ Channel.prototype.close = function () {
 }
 
 Channel.prototype._read = function (size) {
-  //TODO: implement, there's no backpressure here!
+  this._channel.resume()
 }
 
+// the callback waits for the client's window, a slow reader on the other
+// end holds up this stream rather than the whole process
 Channel.prototype._write = function (chunk, encoding, callback) {
-  this._channel.writeData(chunk)
-  callback()
+  this._channel.writeData(chunk, callback)
+}
+
+// run `cmd` with the shell, its stdin, stdout and stderr are connected to
+// the channel natively and bypass this stream. 'exit' is emitted with the
+// exit code or signal and the channel is closed once the output is sent.
+Channel.prototype.execNative = function (cmd, options) {
+  var env = options && options.env
+
+  this._channel.execNative(
+      String(cmd)
+    , options && options.cwd
+    , env && Object.keys(env).map(function (key) {
+        return key + '=' + env[key]
+      })
+  )
+  return this
+}
+
+// write all or part of a file to the channel without it passing through
+// JS, `file` is a path or an open fd. Don't write anything else to the
+// channel until the callback, it gets the number of bytes sent.
+Channel.prototype.sendFile = function (file, options, callback) {
+  if (typeof options == 'function') {
+    callback = options
+    options  = {}
+  }
+  options = options || {}
+
+  this._channel.sendFile(
+      file
+    , options.offset || 0
+    , typeof options.length == 'number' ? options.length : -1
+    , callback || function () {}
+  )
+  return this
 }
 
 Channel.prototype.sendEof = function () {
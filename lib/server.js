@@ -23,10 +23,20 @@ function Server (options) {
 
 util.inherits(Server, EventEmitter)
 
-function setupServer (server) {
-  server._server.onConnection = function (session) {
-    server.emit('connection', new Session(server, session))
-  }
+function setupServer (server, port, addr) {
+  server._server = new libssh.Server(
+      port
+    , addr
+    , server._options.hostRsaKeyFile
+    , server._options.hostDsaKeyFile
+    , server._options.banner
+    , server._options
+  )
+  server._server.setCallbacks({
+    onConnection: function (session) {
+      server.emit('connection', new Session(server, session))
+    }
+  })
 }
 
 Server.prototype.listen = function (port, addr,  callback) {
@@ -38,14 +48,13 @@ Server.prototype.listen = function (port, addr,  callback) {
   }
 
   process.nextTick(function () {
-    this._server = new libssh.Server(
-        port
-      , addr
-      , this._options.hostRsaKeyFile
-      , this._options.hostDsaKeyFile
-      , this._options.banner
-    )
-    setupServer(this)
+    try {
+      setupServer(this, port, addr)
+    } catch (err) {
+      if (callback)
+        return callback(err)
+      return this.emit('error', err)
+    }
     this.emit('ready')
     if (callback)
       callback(null, this)
@@ -54,6 +63,41 @@ Server.prototype.listen = function (port, addr,  callback) {
   return this
 }
 
+// run an ssh session on an already-connected socket, either a file
+// descriptor or a net.Socket that hasn't been read from yet, e.g. from a
+// net.Server created with `pauseOnConnect`. The net.Socket is destroyed
+// once the server has its own copy of the descriptor.
+Server.prototype.handleSocket = function (socket) {
+  var isSocket = typeof socket == 'object'
+    , fd       = isSocket ? socket._handle && socket._handle.fd : socket
+
+  if (typeof fd != 'number' || fd < 0)
+    throw new Error('handleSocket() requires a file descriptor or a connected net.Socket')
+
+  if (!this._server) // no listen(), just handling sockets from elsewhere
+    setupServer(this, null, null)
+
+  this._server.handleSocket(fd, isSocket)
+  if (isSocket)
+    socket.destroy()
+  return this
+}
+
+Server.prototype.reloadHostKeys = function (options) {
+  var rsa = (options && options.hostRsaKeyFile) || this._options.hostRsaKeyFile
+    , dsa = (options && options.hostDsaKeyFile) || this._options.hostDsaKeyFile
+
+  // throws and keeps the current keys if either file can't be imported
+  this._server.reloadHostKeys(rsa, dsa)
+  this._options.hostRsaKeyFile = rsa
+  this._options.hostDsaKeyFile = dsa
+  return this
+}
+
+Server.prototype.stats = function () {
+  return this._server.stats()
+}
+
 Server.prototype.close = function (callback) {
   process.nextTick(function () {
     this._server.close()
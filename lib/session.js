@@ -6,23 +6,36 @@ function Session (server, session) {
   this._session = session
   this._server  = server
 
-  session.onMessage = function (message) {
-    if (this._server._options.debug)
-      console.log('session message', message)
-    if (message.type == 'auth')
-      return this.emit('auth', message)
-    // else handle default.. probably should pass this on
-    message.replyDefault()
-  }.bind(this)
-
-  session.onNewChannel = function (channel) {
-    this.emit('channel', new Channel(this._server, channel))
-    setImmediate(function () {
-      // why setImmediate?? WHO KNOWS! something to do with the
-      // timing of starting polling vs setting up the callbacks
-      channel.start()
-    })
-  }.bind(this)
+  // held natively until the session closes, no lookups per event
+  session.setCallbacks({
+      onMessage: function (message) {
+        if (this._server._options.debug)
+          console.log('session message', message)
+        if (message.type == 'auth')
+          return this.emit('auth', message)
+        // nobody listening means no forwarding
+        if (message.subtype == 'directtcpip' && this.listeners('directtcpip').length)
+          return this.emit('directtcpip', message)
+        // must be answered before we return, the binding refuses it otherwise
+        if (message.subtype == 'tcpipforward' && this.listeners('tcpipforward').length)
+          return this.emit('tcpipforward', message)
+        // else handle default.. probably should pass this on
+        message.replyDefault()
+      }.bind(this)
+
+    , onHandshake: function () {
+        this.emit('handshake')
+      }.bind(this)
+
+    , onNewChannel: function (channel) {
+        this.emit('channel', new Channel(this._server, channel))
+        setImmediate(function () {
+          // why setImmediate?? WHO KNOWS! something to do with the
+          // timing of starting polling vs setting up the callbacks
+          channel.start()
+        })
+      }.bind(this)
+  })
 
   EventEmitter.call(this)
 }
@@ -10,30 +10,99 @@
 #include <libssh/callbacks.h>
 #include <libssh/channels.h>
 #include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <vector>
 #include "channel.h"
+#include "channel_exec.h"
+#include "file_sender.h"
 #include "sftp_message.h"
+#include "sftp_server.h"
 
 namespace nssh {
 
 v8::Persistent<v8::FunctionTemplate> channel_constructor;
 
 static int ids = 0;
+static v8::Persistent<v8::String> onMessage_symbol;
+static v8::Persistent<v8::String> onSftpMessage_symbol;
+static v8::Persistent<v8::String> onData_symbol;
+static v8::Persistent<v8::String> onClose_symbol;
+static v8::Persistent<v8::String> onExit_symbol;
+
+// channel data is read straight into a shared slab Buffer and JS is given
+// the slab and offsets to slice, the same scheme node's own stream reads
+// use, so there's one Buffer allocation per slab rather than per read
+static v8::Persistent<v8::Object> slab;
+static char *slabData = NULL;
+static size_t slabOffset = NSSH_SLAB_SIZE;
+
+// somewhere to read `size` bytes into, a fresh slab if this one's used up
+static char *SlabReserve (size_t size) {
+  if (NSSH_SLAB_SIZE - slabOffset < size) {
+    NanScope();
+    v8::Local<v8::Object> buffer = NanNewBufferHandle(NSSH_SLAB_SIZE);
+    NanDisposePersistent(slab);
+    NanAssignPersistent(slab, buffer);
+    slabData = node::Buffer::Data(buffer);
+    slabOffset = 0;
+  }
+  return slabData + slabOffset;
+}
 
 Channel::Channel () {
   sftp = NULL;
   sftpinit = false;
+  sftpServer = NULL;
+  sftpHandles = NULL;
   callbacks = NULL;
   closed = false;
+  paused = false;
+  writeQueueLength = 0;
+  eofPending = false;
+  exitPending = false;
+  closePending = false;
+  peer = NULL;
+  fileSender = NULL;
+  exitStatus = 0;
+  termSignal = 0;
+  prevChannel = NULL;
+  nextChannel = NULL;
   myid = ids++;
   if (NSSH_DEBUG)
     std::cout << "Channel::Channel! " << myid << "\n";
 }
 
 Channel::~Channel () {
+  if (sftpHandles)
+    delete sftpHandles;
 }
 
-void Channel::SetSftp (sftp_session sftp) {
+void Channel::SetSftp (sftp_session sftp, SftpServer *server, size_t maxHandles) {
   this->sftp = sftp;
+  sftpServer = server;
+  if (server) {
+    server->Attach(this);
+    Ref(); // until CloseChannel()
+  } else {
+    sftpHandles = new HandleTable<v8::Persistent<v8::Value>*>(maxHandles);
+  }
+}
+
+HandleTable<v8::Persistent<v8::Value>*> *Channel::SftpHandles () {
+  return sftpHandles;
+}
+
+// the client has closed it, JS can let go of what it stood for
+void Channel::ReleaseSftpHandle (ssh_string handle) {
+  const char *data = static_cast<const char*>(ssh_string_data(handle));
+  v8::Persistent<v8::Value> **value =
+      sftpHandles ? sftpHandles->Find(data, ssh_string_len(handle)) : NULL;
+  if (!value)
+    return;
+  NanDisposePersistent(**value);
+  delete *value;
+  sftpHandles->Remove(data, ssh_string_len(handle));
 }
 
 // not used, doesn't work so well so we use uv polling instead and process
@@ -64,8 +133,7 @@ void ChannelEofCallback (
   Channel* c = static_cast<Channel*>(userdata);
   if (NSSH_DEBUG)
     std::cout << "ChannelEofCallback!\n";
-  // try one last read!
-  c->CloseChannel();
+  c->RemoteEof();
 }
 
 void ChannelCloseCallback (
@@ -80,6 +148,20 @@ void ChannelCloseCallback (
   c->CloseChannel();
 }
 
+// the client has opened the window, we can't write from in here so get the
+// session to come round to us again
+void ChannelWriteWontblockCallback (
+      ssh_session session
+    , ssh_channel channel
+    , size_t bytes
+    , void *userdata) {
+
+  Channel* c = static_cast<Channel*>(userdata);
+  if (NSSH_DEBUG)
+    std::cout << "ChannelWriteWontblockCallback " << bytes << std::endl;
+  c->Wake();
+}
+
 void ChannelSignalCallback (
       ssh_session session
     , ssh_channel channel
@@ -97,11 +179,12 @@ void Channel::SetupCallbacks (bool includeData) {
   if (NSSH_DEBUG)
     std::cout << "SetupCallbacks()\n";
 
-  callbacks = new ssh_channel_callbacks_struct;
+  callbacks = new ssh_channel_callbacks_struct();
   callbacks->channel_data_function = 0; // See note at ChannelCloseCallback
   callbacks->channel_eof_function = ChannelEofCallback;
   callbacks->channel_close_function = ChannelCloseCallback;
   callbacks->channel_signal_function = ChannelSignalCallback;
+  callbacks->channel_write_wontblock_function = ChannelWriteWontblockCallback;
   callbacks->userdata = this;
   ssh_callbacks_init(callbacks);
   ssh_set_channel_callbacks(channel, callbacks);
@@ -109,9 +192,10 @@ void Channel::SetupCallbacks (bool includeData) {
 
 void Channel::CloseChannel () {
   if (!closed) {
-    TryRead(); // one last time
+    TryRead(NULL); // one last time, everything that's left
     if (NSSH_DEBUG)
       std::cout << "CloseChannel, closed = true " << myid << "\n";
+    FailWrites("Channel closed before the write completed");
     if (NSSH_DEBUG)
       std::cout << "ssh_channel_close()\n";
     ssh_channel_close(channel);
@@ -120,12 +204,74 @@ void Channel::CloseChannel () {
       channelClosedCallback(this, callbackUserData);
     //TryRead(); // not really a read, just flush the msg buffer
                // otherwise the channel may just hang
-    closed = true;
-    OnClose();
+    Teardown();
+  }
+}
+
+// the session has gone, ssh_free() takes the libssh channel with it so
+// there's nothing to close, but JS and anything native still has to let
+// go of us
+void Channel::SessionClosed () {
+  if (closed)
+    return;
+  if (NSSH_DEBUG)
+    std::cout << "SessionClosed, closed = true " << myid << "\n";
+  FailWrites("Session closed before the write completed");
+  Teardown();
+}
+
+void Channel::FailWrites (const char *error) {
+  closePending = false;
+  while (!writeQueue.empty()) {
+    ChannelWrite *write = PopWrite();
+    CompleteWrite(write, error);
   }
 }
 
-bool Channel::TryRead () {
+void Channel::Teardown () {
+  closed = true;
+  OnClose();
+  // they close over the JS object wrapping us, nothing more is coming
+  NanDisposePersistent(onMessage);
+  NanDisposePersistent(onSftpMessage);
+  NanDisposePersistent(onData);
+  NanDisposePersistent(onClose);
+  NanDisposePersistent(onExit);
+  DetachPeer(); // closed before the peer was done
+  DetachSftpServer();
+  if (fileSender) {
+    FileSender *sender = fileSender;
+    fileSender = NULL;
+    sender->Detach();
+  }
+  if (sftpHandles) {
+    for (size_t i = 0; i < sftpHandles->Slots(); i++) {
+      v8::Persistent<v8::Value> **value = sftpHandles->At(i);
+      if (!value)
+        continue;
+      NanDisposePersistent(**value);
+      delete *value;
+    }
+    sftpHandles->Clear();
+  }
+}
+
+// the client won't send any more, a peer is told and the channel stays
+// open for its output, otherwise we close
+void Channel::RemoteEof () {
+  if (!peer) {
+    // try one last read!
+    CloseChannel();
+    return;
+  }
+  TryRead(NULL);
+  if (peer)
+    peer->RemoteEof();
+}
+
+// reads up to the budget unless `exhausted` is NULL, it's set if we stopped
+// because of the budget and there may be more waiting
+bool Channel::TryRead (bool *exhausted) {
   NanScope();
 
   if (NSSH_DEBUG)
@@ -135,9 +281,15 @@ bool Channel::TryRead () {
 
   sftp_client_message sftpmessage;
   bool read = false;
+  int budget;
 
   if (sftp) {
+    budget = NSSH_SFTP_MESSAGE_BUDGET;
     while (true) {
+      if (exhausted && budget-- == 0) {
+        *exhausted = true;
+        break;
+      }
       if (!sftpinit) {
         int rc = sftp_server_init(sftp);
         if (rc) {
@@ -154,11 +306,27 @@ bool Channel::TryRead () {
       if (NSSH_DEBUG)
         std::cout << "sftp=true\n";
 
+      // the server wakes us when it can take another
+      if (sftpServer && !sftpServer->Ready())
+        break;
+
       sftpmessage = sftp_get_client_message(sftp);
       if (sftpmessage) {
         read = true;
         if (NSSH_DEBUG)
           std::cout << "TryRead sftp Message " << sftpmessage << std::endl;
+        if (sftpServer) {
+          sftpServer->Handle(sftpmessage);
+          continue;
+        }
+        // JS only sees handles it gave out that are still open
+        if (sftpmessage->handle && !sftpHandles->Find(
+              static_cast<const char*>(ssh_string_data(sftpmessage->handle))
+            , ssh_string_len(sftpmessage->handle))) {
+          sftp_reply_status(sftpmessage, SSH_FX_FAILURE, "Invalid handle");
+          sftp_client_message_free(sftpmessage);
+          continue;
+        }
         v8::Handle<v8::Object> mess = SftpMessage::NewInstance(session, this, sftpmessage);
         OnSftpMessage(mess);
       } else
@@ -168,23 +336,333 @@ bool Channel::TryRead () {
   }
 
   int len;
+  int available;
+  // reads in a pass land back to back in the slab, so JS gets the lot in
+  // one onData() call rather than a call per read
+  size_t batchStart = 0;
+  size_t batchEnd = 0;
+  budget = NSSH_CHANNEL_READ_BUDGET;
   do {
-    char buf[1024];
-    len = ssh_channel_read_nonblocking(channel, buf, sizeof(buf), 0);
+    // the last read before closing ignores pause, nothing comes after it
+    if (exhausted && paused)
+      break;
+    if (exhausted && budget <= 0) {
+      *exhausted = true;
+      break;
+    }
+    // everything libssh has buffered for us, up to a slab at a time
+    available = ssh_channel_poll(channel, 0);
+    if (available <= 0)
+      break;
+    if (available > NSSH_SLAB_SIZE)
+      available = NSSH_SLAB_SIZE;
+
+    // a batch can't span slabs, deliver what we have before moving on
+    if (batchEnd > batchStart
+        && NSSH_SLAB_SIZE - slabOffset < (size_t)available) {
+      OnData(NanNew(slab), batchStart, batchEnd);
+      batchStart = batchEnd = 0;
+    }
+
+    if (peer) {
+      char *data = static_cast<char*>(malloc(available));
+      // out of memory, leave it with libssh and try again next pass
+      if (!data)
+        break;
+      len = ssh_channel_read_nonblocking(channel, data, available, 0);
+      if (len <= 0) {
+        free(data);
+        break;
+      }
+      read = true;
+      budget -= len;
+      // the peer is backed up, leave the rest with libssh
+      if (!peer->Write(data, len))
+        paused = true;
+      // a failed write is the peer done with us, and maybe the channel
+      // closed, the rest mustn't go to JS in its place
+      if (!peer || closed)
+        break;
+      continue;
+    }
+
+    char *buf = SlabReserve(available);
+    len = ssh_channel_read_nonblocking(channel, buf, available, 0);
     if (len > 0) {
       read = true;
       if (NSSH_DEBUG)
         std::cout << "Read buf = " << std::string(buf, len) << std::endl;
-      OnData(buf, len);
+      budget -= len;
+      if (batchEnd == batchStart)
+        batchStart = slabOffset;
+      slabOffset += len;
+      batchEnd = slabOffset;
     } else
       break;
   } while (true);
 
+  if (batchEnd > batchStart)
+    OnData(NanNew(slab), batchStart, batchEnd);
+
   if (NSSH_DEBUG)
     std::cout << "Channel::TryRead len=" << len << std::endl;
   return read;
 }
 
+// have the session give us a read and write pass soon even if the socket
+// has nothing new for it
+void Channel::Wake () {
+  if (!closed && channelResumedCallback)
+    channelResumedCallback(this, callbackUserData);
+}
+
+bool Channel::HasQueuedWrites () {
+  return !writeQueue.empty() || eofPending || closePending;
+}
+
+// hand libssh as much as the remote window will take, ssh_channel_write()
+// would otherwise sit in a loop waiting for a window adjust
+void Channel::FlushWrites () {
+  NanScope();
+
+  while (!writeQueue.empty() && !closed) {
+    ChannelWrite *write = writeQueue.front();
+    uint32_t window = ssh_channel_window_size(channel);
+    if (window == 0)
+      return; // ChannelWriteWontblockCallback() brings us back
+
+    size_t len = write->length - write->written;
+    if (len > window)
+      len = window;
+
+    int rc = 0;
+    if (len && write->isStderr)
+      rc = ssh_channel_write_stderr(channel, write->data + write->written, len);
+    else if (len)
+      rc = ssh_channel_write(channel, write->data + write->written, len);
+    if (rc < 0) {
+      std::string err("Error writing to channel: ");
+      err.append(ssh_get_error(session));
+      while (!writeQueue.empty()) {
+        write = PopWrite();
+        CompleteWrite(write, err.c_str());
+      }
+      return;
+    }
+
+    if (NSSH_DEBUG)
+      std::cout << "FlushWrites wrote " << rc << " of " << len << std::endl;
+
+    write->written += rc;
+    // the rest would block: the window didn't cover it or libssh is
+    // rekeying, the wontblock callback or the next pass brings us back
+    if (write->written < write->length)
+      return;
+
+    PopWrite();
+    CompleteWrite(write, NULL);
+  }
+
+  if (!writeQueue.empty() || closed)
+    return;
+
+  if (eofPending) {
+    eofPending = false;
+    ssh_channel_send_eof(channel);
+  }
+  if (exitPending) {
+    exitPending = false;
+    SendExit();
+  }
+  if (closePending) {
+    closePending = false;
+    CloseChannel();
+  }
+}
+
+void Channel::QueueWrite (ChannelWrite *write) {
+  writeQueue.push_back(write);
+  writeQueueLength += write->length;
+  FlushWrites();
+  // the session picks up its poll for writability on its next pass
+  if (ssh_get_poll_flags(session) & SSH_WRITE_PENDING)
+    Wake();
+}
+
+ChannelWrite *Channel::PopWrite () {
+  ChannelWrite *write = writeQueue.front();
+  writeQueue.pop_front();
+  writeQueueLength -= write->length;
+  return write;
+}
+
+void Channel::CompleteWrite (ChannelWrite *write, const char *error) {
+  NanScope();
+
+  if (write->writer) {
+    write->writer->WriteDone(write->data, error);
+    delete write;
+    return;
+  }
+
+  if (!write->callback) { // execNative() output
+    free(write->data);
+    delete write;
+    if (peer)
+      peer->OutputDrained();
+    return;
+  }
+
+  NanDisposePersistent(write->buffer);
+  if (error) {
+    v8::Local<v8::Value> argv[] = { NanError(error) };
+    write->callback->Call(1, argv);
+  } else {
+    write->callback->Call(0, NULL);
+  }
+  delete write->callback;
+  delete write;
+}
+
+size_t Channel::QueuedLength () {
+  return writeQueueLength;
+}
+
+bool Channel::IsClosed () {
+  return closed;
+}
+
+// `data` goes back to the writer once it has been sent
+void Channel::WriteNative (char *data, size_t length, ChannelWriter *writer) {
+  ChannelWrite *write = new ChannelWrite;
+  write->callback = NULL;
+  write->writer = writer;
+  write->data = data;
+  write->length = length;
+  write->written = 0;
+  write->isStderr = false;
+  QueueWrite(write);
+}
+
+// data runs between the channel and `peer` natively from here on, it
+// keeps us alive until it's done
+void Channel::StartPeer (ChannelPeer *peer) {
+  this->peer = peer;
+  Ref();
+  if (!callbacks)
+    SetupCallbacks(false);
+  paused = false;
+  Wake();
+}
+
+void Channel::DetachPeer () {
+  if (!peer)
+    return;
+  peer->Detach();
+  peer = NULL;
+  Unref();
+}
+
+void Channel::StartFileSender (FileSender *sender) {
+  fileSender = sender;
+}
+
+void Channel::FileSenderDone (FileSender *sender) {
+  if (fileSender == sender)
+    fileSender = NULL;
+}
+
+// the native SFTP server's requests still on the threadpool finish without
+// touching us
+void Channel::DetachSftpServer () {
+  if (!sftpServer)
+    return;
+  sftpServer->Detach();
+  sftpServer = NULL;
+  Unref();
+}
+
+void Channel::PeerOutput (char *data, size_t length, bool isStderr) {
+  ChannelWrite *write = new ChannelWrite;
+  write->callback = NULL;
+  write->writer = NULL;
+  write->data = data;
+  write->length = length;
+  write->written = 0;
+  write->isStderr = isStderr;
+  QueueWrite(write);
+}
+
+void Channel::PeerInputDrained () {
+  if (paused) {
+    paused = false;
+    Wake();
+  }
+}
+
+// the peer won't send any more, the EOF follows whatever it has queued
+void Channel::PeerEof () {
+  if (closed)
+    return;
+  eofPending = true;
+  FlushWrites();
+  Wake();
+}
+
+// the peer is finished with us, we close once its output has gone
+void Channel::PeerDone () {
+  peer = NULL;
+  if (!closed) {
+    closePending = true;
+    FlushWrites();
+    Wake();
+  }
+  Unref();
+}
+
+// the child has exited and all its output is queued, the exit status and
+// close follow it out
+void Channel::ExecDone (int64_t exitStatus, int termSignal) {
+  this->exitStatus = exitStatus;
+  this->termSignal = termSignal;
+  OnExit();
+  if (!closed) {
+    eofPending = true;
+    exitPending = true;
+  }
+  PeerDone();
+}
+
+static const char *SignalName (int signal) {
+  switch (signal) {
+#ifndef _WIN32
+    case SIGHUP:  return "HUP";
+    case SIGQUIT: return "QUIT";
+    case SIGPIPE: return "PIPE";
+    case SIGALRM: return "ALRM";
+    case SIGUSR1: return "USR1";
+    case SIGUSR2: return "USR2";
+    case SIGKILL: return "KILL";
+#endif
+    case SIGINT:  return "INT";
+    case SIGILL:  return "ILL";
+    case SIGABRT: return "ABRT";
+    case SIGFPE:  return "FPE";
+    case SIGSEGV: return "SEGV";
+    case SIGTERM: return "TERM";
+  }
+  return NULL;
+}
+
+void Channel::SendExit () {
+  const char *signal = termSignal ? SignalName(termSignal) : NULL;
+  if (signal)
+    ssh_channel_request_send_exit_signal(channel, signal, 0, "", "");
+  else // a signal without a name for it gets the shell's 128 + n
+    ssh_channel_request_send_exit_status(
+        channel, termSignal ? 128 + termSignal : (int)exitStatus);
+}
+
 bool Channel::IsChannel (ssh_channel channel) {
   return this->channel == channel;
 }
@@ -195,13 +673,10 @@ void Channel::OnMessage (v8::Handle<v8::Object> mess) {
   if (NSSH_DEBUG)
     std::cout << "Channel::OnMessage\n";
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onMessage"));
-
-  if (callback->IsFunction()) {
+  if (!onMessage.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = { mess };
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onMessage)->Call(NanObjectWrapHandle(this), 1, argv);
 
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
@@ -214,13 +689,10 @@ void Channel::OnSftpMessage (v8::Handle<v8::Object> mess) {
   if (NSSH_DEBUG)
     std::cout << "Channel::OnSftpMessage\n";
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onSftpMessage"));
-
-  if (callback->IsFunction()) {
+  if (!onSftpMessage.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = { mess };
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onSftpMessage)->Call(NanObjectWrapHandle(this), 1, argv);
 
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
@@ -230,31 +702,63 @@ void Channel::OnSftpMessage (v8::Handle<v8::Object> mess) {
 void Channel::OnData (const char *data, int length) {
   NanScope();
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onData"));
+  // copied into the slab a slab's worth at a time
+  while (length > 0) {
+    size_t size = length > NSSH_SLAB_SIZE ? NSSH_SLAB_SIZE : length;
+    char *buf = SlabReserve(size);
+    memcpy(buf, data, size);
+    size_t start = slabOffset;
+    slabOffset += size;
+    OnData(NanNew(slab), start, slabOffset);
+    data += size;
+    length -= size;
+  }
+}
+
+void Channel::OnData (v8::Handle<v8::Object> buffer, size_t start, size_t end) {
+  NanScope();
 
-  if (callback->IsFunction()) {
+  if (!onData.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = {
-      NanNewBufferHandle((char *)data, length)
+        buffer
+      , NanNew<v8::Number>(start)
+      , NanNew<v8::Number>(end)
     };
 
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onData)->Call(NanObjectWrapHandle(this), 3, argv);
 
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
   }
 }
 
-void Channel::OnClose () {
+void Channel::OnExit () {
   NanScope();
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onClose"));
+  if (!onExit.IsEmpty()) {
+    const char *signal = termSignal ? SignalName(termSignal) : NULL;
+    v8::TryCatch try_catch;
+    v8::Handle<v8::Value> argv[] = {
+        termSignal
+          ? NanNull()
+          : NanNew<v8::Number>(static_cast<double>(exitStatus))
+      , signal
+          ? NanNew<v8::String>(std::string("SIG") + signal)
+          : NanNull()
+    };
+    NanNew(onExit)->Call(NanObjectWrapHandle(this), 2, argv);
+    if (try_catch.HasCaught())
+      node::FatalException(try_catch);
+  }
+}
 
-  if (callback->IsFunction()) {
+void Channel::OnClose () {
+  NanScope();
+
+  if (!onClose.IsEmpty()) {
     v8::TryCatch try_catch;
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 0, NULL);
+    NanNew(onClose)->Call(NanObjectWrapHandle(this), 0, NULL);
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
   }
@@ -272,12 +776,24 @@ void Channel::Init () {
   NODE_SET_PROTOTYPE_METHOD(tpl, "sendEof", SendEof);
   NODE_SET_PROTOTYPE_METHOD(tpl, "sendExitStatus", SendExitStatus);
   NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "pause", Pause);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "resume", Resume);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "setCallbacks", SetCallbacks);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "execNative", ExecNative);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "sendFile", SendFile);
+
+  NanAssignPersistent(onMessage_symbol, NanNew<v8::String>("onMessage"));
+  NanAssignPersistent(onSftpMessage_symbol, NanNew<v8::String>("onSftpMessage"));
+  NanAssignPersistent(onData_symbol, NanNew<v8::String>("onData"));
+  NanAssignPersistent(onClose_symbol, NanNew<v8::String>("onClose"));
+  NanAssignPersistent(onExit_symbol, NanNew<v8::String>("onExit"));
 }
 
 v8::Handle<v8::Object> Channel::NewInstance (
       ssh_session session
     , ssh_channel channel
     , ChannelClosedCallback channelClosedCallback
+    , ChannelResumedCallback channelResumedCallback
     , void *callbackUserData
   ) {
 
@@ -290,6 +806,7 @@ v8::Handle<v8::Object> Channel::NewInstance (
   c->channel = channel;
   c->session = session;
   c->channelClosedCallback = channelClosedCallback;
+  c->channelResumedCallback = channelResumedCallback;
   c->callbackUserData = callbackUserData;
 
   return NanEscapeScope(instance);
@@ -318,10 +835,27 @@ NAN_METHOD(Channel::New) {
 NAN_METHOD(Channel::WriteData) {
   NanScope();
 
-  //TODO: async
   Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
-  ssh_channel_write(c->channel,
-      node::Buffer::Data(args[0]), node::Buffer::Length(args[0]));
+
+  if (!node::Buffer::HasInstance(args[0]) || !args[1]->IsFunction())
+    return NanThrowError("writeData() requires a Buffer and a callback");
+
+  ChannelWrite *write = new ChannelWrite;
+  v8::Local<v8::Object> buffer = args[0].As<v8::Object>();
+  NanAssignPersistent(write->buffer, buffer);
+  write->callback = new NanCallback(args[1].As<v8::Function>());
+  write->data = node::Buffer::Data(buffer);
+  write->length = node::Buffer::Length(buffer);
+  write->written = 0;
+  write->writer = NULL;
+  write->isStderr = false;
+
+  if (c->closed) {
+    c->CompleteWrite(write, "Channel is closed");
+    NanReturnUndefined();
+  }
+
+  c->QueueWrite(write);
 
   NanReturnUndefined();
 }
@@ -331,7 +865,8 @@ NAN_METHOD(Channel::SendExitStatus) {
 
   //TODO: async
   Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
-  ssh_channel_request_send_exit_status(c->channel, args[0]->Int32Value());
+  if (!c->closed)
+    ssh_channel_request_send_exit_status(c->channel, args[0]->Int32Value());
 
   NanReturnUndefined();
 }
@@ -341,7 +876,10 @@ NAN_METHOD(Channel::Close) {
 
   //TODO: async
   Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
-  c->CloseChannel();
+  if (c->writeQueue.empty())
+    c->CloseChannel();
+  else
+    c->closePending = true;
 
   NanReturnUndefined();
 }
@@ -351,7 +889,9 @@ NAN_METHOD(Channel::SendEof) {
 
   //TODO: async
   Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
-  if (!c->closed)
+  if (!c->writeQueue.empty())
+    c->eofPending = true;
+  else if (!c->closed)
     ssh_channel_send_eof(c->channel);
 
   if (NSSH_DEBUG)
@@ -360,4 +900,115 @@ NAN_METHOD(Channel::SendEof) {
   NanReturnUndefined();
 }
 
+// stop reading until resume(), libssh keeps what arrives in the meantime
+// and only opens the window again as we read it
+NAN_METHOD(Channel::Pause) {
+  NanScope();
+
+  Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
+  c->paused = true;
+
+  NanReturnUndefined();
+}
+
+NAN_METHOD(Channel::Resume) {
+  NanScope();
+
+  Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
+  if (c->paused) {
+    c->paused = false;
+    // whatever libssh is holding won't wake the socket poll
+    c->Wake();
+  }
+
+  NanReturnUndefined();
+}
+
+NAN_METHOD(Channel::SetCallbacks) {
+  NanScope();
+
+  if (!args[0]->IsObject())
+    return NanThrowError("setCallbacks() requires an object");
+
+  Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
+  v8::Local<v8::Object> callbacks = args[0].As<v8::Object>();
+  SetCallback(c->onMessage, callbacks, onMessage_symbol);
+  SetCallback(c->onSftpMessage, callbacks, onSftpMessage_symbol);
+  SetCallback(c->onData, callbacks, onData_symbol);
+  SetCallback(c->onClose, callbacks, onClose_symbol);
+  SetCallback(c->onExit, callbacks, onExit_symbol);
+
+  NanReturnUndefined();
+}
+
+// execNative(cmd, cwd, env), env is an array of "NAME=value" strings
+NAN_METHOD(Channel::ExecNative) {
+  NanScope();
+
+  Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
+
+  if (!args[0]->IsString())
+    return NanThrowError("execNative() requires a command");
+  if (c->closed)
+    return NanThrowError("Channel is closed");
+  if (c->peer || c->sftp || c->fileSender)
+    return NanThrowError("Channel is already in use");
+
+  v8::String::Utf8Value cmd(args[0]);
+  v8::String::Utf8Value cwd(args[1]);
+
+  std::vector<std::string> envStrings;
+  std::vector<char*> env;
+  if (args[2]->IsArray()) {
+    v8::Local<v8::Array> envArray = args[2].As<v8::Array>();
+    for (uint32_t i = 0; i < envArray->Length(); i++)
+      envStrings.push_back(*v8::String::Utf8Value(envArray->Get(i)));
+    for (size_t i = 0; i < envStrings.size(); i++)
+      env.push_back(const_cast<char*>(envStrings[i].c_str()));
+    env.push_back(NULL);
+  }
+
+  std::string error;
+  ChannelExec *exec = ChannelExec::Spawn(
+      c
+    , *cmd
+    , args[1]->IsString() ? *cwd : NULL
+    , env.empty() ? NULL : &env[0]
+    , error
+  );
+  if (!exec)
+    return NanThrowError(error.c_str());
+
+  c->StartPeer(exec);
+
+  NanReturnUndefined();
+}
+
+// sendFile(path | fd, offset, length, callback), a length of -1 sends to
+// the end of the file
+NAN_METHOD(Channel::SendFile) {
+  NanScope();
+
+  Channel* c = node::ObjectWrap::Unwrap<Channel>(args.This());
+
+  if ((!args[0]->IsString() && !args[0]->IsNumber()) || !args[3]->IsFunction())
+    return NanThrowError("sendFile() requires a path or fd and a callback");
+  if (c->closed)
+    return NanThrowError("Channel is closed");
+  if (c->peer || c->sftp || c->fileSender)
+    return NanThrowError("Channel is already in use");
+
+  v8::String::Utf8Value path(args[0]);
+  FileSender::Start(
+      c
+    , args[0]->IsString() ? *path : NULL
+    , args[0]->Int32Value()
+    , args[1]->IntegerValue()
+    , args[2]->IsNumber() ? args[2]->IntegerValue() : -1
+    , new NanCallback(args[3].As<v8::Function>())
+  );
+
+  NanReturnUndefined();
+}
+
 } // namespace nssh
@@ -11,21 +11,65 @@
 #include <libssh/sftp.h>
 #include <libssh/callbacks.h>
 #include <string>
+#include <deque>
 #include <nan.h>
 
 #include "nssh.h"
+#include "handle_table.h"
 
 namespace nssh {
 
+class SftpServer;
+class FileSender;
+
+// native code writing its own buffers to a channel, told when each one has
+// been sent (or failed) so it can be reused
+class ChannelWriter {
+ public:
+  virtual ~ChannelWriter () {}
+  virtual void WriteDone (char *data, const char *error) = 0;
+};
+
+// something native on the other end of a channel's data in place of JS, an
+// execNative() child or a forwarded TCP connection. It sends its output
+// with PeerOutput() and says when it's done with PeerEof() / PeerDone().
+class ChannelPeer {
+ public:
+  virtual ~ChannelPeer () {}
+  // takes a malloc()ed buffer, returns false if the peer is behind and
+  // calls PeerInputDrained() once it catches up
+  virtual bool Write (char *data, size_t length) = 0;
+  virtual void RemoteEof () = 0;
+  // the channel has sent some of the peer's output
+  virtual void OutputDrained () = 0;
+  // the channel is going away, stop using it
+  virtual void Detach () = 0;
+};
+
+// a Buffer waiting for the remote window, the callback fires once all of it
+// has been handed to libssh. Native writes have no callback, they go back
+// to their writer or, for execNative() output, are malloc()ed and freed.
+struct ChannelWrite {
+  v8::Persistent<v8::Object> buffer;
+  NanCallback *callback;
+  ChannelWriter *writer;
+  char *data;
+  size_t length;
+  size_t written;
+  bool isStderr;
+};
+
 class Channel : public node::ObjectWrap {
  public:
   typedef void (*ChannelClosedCallback) (Channel *channel, void *userData);
+  typedef void (*ChannelResumedCallback) (Channel *channel, void *userData);
 
   static void Init ();
   static v8::Handle<v8::Object> NewInstance (
       ssh_session session
     , ssh_channel channel
     , ChannelClosedCallback channelClosedCallback
+    , ChannelResumedCallback channelResumedCallback
     , void *callbackUserData
   );
 
@@ -34,31 +78,84 @@ class Channel : public node::ObjectWrap {
 
   void Setup ();
   void CloseChannel ();
-  void SetSftp (sftp_session sftp);
+  void SessionClosed ();
+  // with a `server` its requests are served natively, not by JS
+  void SetSftp (sftp_session sftp, SftpServer *server, size_t maxHandles);
+  // what SFTP handles given to the client stand for in JS
+  HandleTable<v8::Persistent<v8::Value>*> *SftpHandles ();
+  void ReleaseSftpHandle (ssh_string handle);
 
   ssh_channel channel;
   int myid;
+  // the owning Session's list of open channels
+  Channel *prevChannel;
+  Channel *nextChannel;
 
   void OnError (std::string error);
   void OnMessage (v8::Handle<v8::Object> message);
   void OnSftpMessage (v8::Handle<v8::Object> message);
   void OnData (const char *data, int length);
+  void OnData (v8::Handle<v8::Object> buffer, size_t start, size_t end);
   void OnClose ();
   bool IsChannel (ssh_channel);
-  bool TryRead ();
+  bool TryRead (bool *exhausted);
+  void FlushWrites ();
+  bool HasQueuedWrites ();
+  void Wake ();
+  void RemoteEof ();
+  bool IsClosed ();
+  void WriteNative (char *data, size_t length, ChannelWriter *writer);
+
+  // for the ChannelPeer we're connected to
+  void StartPeer (ChannelPeer *peer);
+  void DetachPeer ();
+  void PeerOutput (char *data, size_t length, bool isStderr);
+  void PeerInputDrained ();
+  void PeerEof ();
+  void PeerDone ();
+  void ExecDone (int64_t exitStatus, int termSignal);
+  size_t QueuedLength ();
+
+  // sendFile() has the channel until its sender is done
+  void StartFileSender (FileSender *sender);
+  void FileSenderDone (FileSender *sender);
 
  private:
   static void SocketPollCallback(uv_poll_t* handle, int status, int events);
 
   void SetupCallbacks (bool includeData);
+  void FailWrites (const char *error);
+  void Teardown ();
+  void DetachSftpServer ();
+  void CompleteWrite (ChannelWrite *write, const char *error);
+  void QueueWrite (ChannelWrite *write);
+  ChannelWrite *PopWrite ();
+  void SendExit ();
+  void OnExit ();
 
   sftp_session sftp;
   bool sftpinit;
+  SftpServer *sftpServer;
+  HandleTable<v8::Persistent<v8::Value>*> *sftpHandles;
   ChannelClosedCallback channelClosedCallback;
+  ChannelResumedCallback channelResumedCallback;
   void *callbackUserData;
   ssh_session session;
   ssh_channel_callbacks_struct *callbacks;
   bool closed;
+  // JS isn't keeping up, leave data with libssh so the window closes
+  bool paused;
+  std::deque<ChannelWrite*> writeQueue;
+  size_t writeQueueLength;
+  // held back until everything written before them has gone
+  bool eofPending;
+  bool exitPending;
+  bool closePending;
+  // data goes here rather than to JS
+  ChannelPeer *peer;
+  FileSender *fileSender;
+  int64_t exitStatus;
+  int termSignal;
 
   static NAN_METHOD(New);
   static NAN_METHOD(Start);
@@ -66,6 +163,18 @@ class Channel : public node::ObjectWrap {
   static NAN_METHOD(SendExitStatus);
   static NAN_METHOD(Close);
   static NAN_METHOD(SendEof);
+  static NAN_METHOD(Pause);
+  static NAN_METHOD(Resume);
+  static NAN_METHOD(SetCallbacks);
+  static NAN_METHOD(ExecNative);
+  static NAN_METHOD(SendFile);
+
+  // set from JS by setCallbacks(), let go of on close
+  v8::Persistent<v8::Function> onMessage;
+  v8::Persistent<v8::Function> onSftpMessage;
+  v8::Persistent<v8::Function> onData;
+  v8::Persistent<v8::Function> onClose;
+  v8::Persistent<v8::Function> onExit;
 
 };
 
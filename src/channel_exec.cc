@@ -0,0 +1,358 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "channel_exec.h"
+
+namespace nssh {
+
+#if UV_VERSION_MAJOR >= 1
+
+// a chunk of channel data on its way to the child's stdin
+struct ExecWrite {
+  uv_write_t req;
+  char *data;
+  size_t length;
+};
+
+ChannelExec::ChannelExec (Channel *channel) {
+  this->channel = channel;
+  handles = 0;
+  exited = false;
+  stdinClosed = false;
+  stdoutDone = false;
+  stderrDone = false;
+  inputStopped = false;
+  outputStopped = false;
+  stdinQueued = 0;
+  exitStatus = 0;
+  termSignal = 0;
+}
+
+ChannelExec *ChannelExec::Spawn (
+      Channel *channel
+    , const char *cmd
+    , const char *cwd
+    , char **env
+    , std::string &error
+  ) {
+
+  ChannelExec *e = new ChannelExec(channel);
+  uv_loop_t *loop = uv_default_loop();
+
+  uv_pipe_init(loop, &e->stdinPipe, 0);
+  uv_pipe_init(loop, &e->stdoutPipe, 0);
+  uv_pipe_init(loop, &e->stderrPipe, 0);
+  e->stdinPipe.data = e;
+  e->stdoutPipe.data = e;
+  e->stderrPipe.data = e;
+  e->process.data = e;
+  e->handles = 4;
+
+  uv_stdio_container_t stdio[3];
+  stdio[0].flags = (uv_stdio_flags)(UV_CREATE_PIPE | UV_READABLE_PIPE);
+  stdio[0].data.stream = reinterpret_cast<uv_stream_t*>(&e->stdinPipe);
+  stdio[1].flags = (uv_stdio_flags)(UV_CREATE_PIPE | UV_WRITABLE_PIPE);
+  stdio[1].data.stream = reinterpret_cast<uv_stream_t*>(&e->stdoutPipe);
+  stdio[2].flags = (uv_stdio_flags)(UV_CREATE_PIPE | UV_WRITABLE_PIPE);
+  stdio[2].data.stream = reinterpret_cast<uv_stream_t*>(&e->stderrPipe);
+
+  // the command goes to the shell, the same as sshd does it
+#ifdef _WIN32
+  // cmd.exe /s strips the outer quotes itself, libuv mustn't quote or
+  // escape anything inside them, the same as child_process.exec()
+  std::string quoted = std::string("\"") + cmd + "\"";
+  char *args[] = {
+      const_cast<char*>("cmd.exe")
+    , const_cast<char*>("/s")
+    , const_cast<char*>("/c")
+    , const_cast<char*>(quoted.c_str())
+    , NULL
+  };
+#else
+  char *args[] = {
+      const_cast<char*>("/bin/sh")
+    , const_cast<char*>("-c")
+    , const_cast<char*>(cmd)
+    , NULL
+  };
+#endif
+
+  uv_process_options_t options;
+  memset(&options, 0, sizeof(options));
+  options.exit_cb = ExitCallback;
+  options.file = args[0];
+  options.args = args;
+  options.cwd = cwd;
+  options.env = env;
+  options.stdio_count = 3;
+  options.stdio = stdio;
+#ifdef _WIN32
+  options.flags = UV_PROCESS_WINDOWS_VERBATIM_ARGUMENTS;
+#endif
+
+  int rc = uv_spawn(loop, &e->process, &options);
+  if (rc) {
+    error.assign("Error spawning process: ");
+    error.append(uv_strerror(rc));
+    e->channel = NULL;
+    e->exited = true;
+    e->stdinClosed = true;
+    e->stdoutDone = true;
+    e->stderrDone = true;
+    e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->process));
+    e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->stdinPipe));
+    e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->stdoutPipe));
+    e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->stderrPipe));
+    return NULL;
+  }
+
+  if (NSSH_DEBUG)
+    std::cout << "ChannelExec::Spawn pid=" << e->process.pid << std::endl;
+
+  uv_read_start(
+      reinterpret_cast<uv_stream_t*>(&e->stdoutPipe)
+    , AllocCallback
+    , ReadCallback
+  );
+  uv_read_start(
+      reinterpret_cast<uv_stream_t*>(&e->stderrPipe)
+    , AllocCallback
+    , ReadCallback
+  );
+
+  return e;
+}
+
+bool ChannelExec::Write (char *data, size_t length) {
+  if (stdinClosed) {
+    free(data);
+    return true;
+  }
+
+  ExecWrite *write = new ExecWrite;
+  write->data = data;
+  write->length = length;
+  uv_buf_t buf = uv_buf_init(data, length);
+  int rc = uv_write(
+      &write->req
+    , reinterpret_cast<uv_stream_t*>(&stdinPipe)
+    , &buf
+    , 1
+    , WriteCallback
+  );
+  if (rc) { // the child has gone, drop it like sshd would
+    free(data);
+    delete write;
+    return true;
+  }
+
+  stdinQueued += length;
+  if (stdinQueued >= NSSH_EXEC_BUFFER)
+    inputStopped = true;
+  return !inputStopped;
+}
+
+void ChannelExec::WriteCallback (uv_write_t *req, int status) {
+  ExecWrite *write = reinterpret_cast<ExecWrite*>(req);
+  ChannelExec *e = static_cast<ChannelExec*>(req->handle->data);
+
+  e->stdinQueued -= write->length;
+  free(write->data);
+  delete write;
+
+  if (status < 0 && NSSH_DEBUG)
+    std::cout << "ChannelExec stdin write error " << uv_strerror(status) << std::endl;
+
+  if (e->inputStopped && e->stdinQueued < NSSH_EXEC_BUFFER) {
+    e->inputStopped = false;
+    if (e->channel)
+      e->channel->PeerInputDrained();
+  }
+}
+
+void ChannelExec::RemoteEof () {
+  CloseStdin();
+}
+
+// the child gets its EOF once everything before it is written
+void ChannelExec::CloseStdin () {
+  if (stdinClosed)
+    return;
+  stdinClosed = true;
+
+  uv_shutdown_t *req = new uv_shutdown_t;
+  int rc = uv_shutdown(
+      req
+    , reinterpret_cast<uv_stream_t*>(&stdinPipe)
+    , ShutdownCallback
+  );
+  if (rc) {
+    delete req;
+    CloseHandle(reinterpret_cast<uv_handle_t*>(&stdinPipe));
+  }
+}
+
+void ChannelExec::ShutdownCallback (uv_shutdown_t *req, int status) {
+  ChannelExec *e = static_cast<ChannelExec*>(req->handle->data);
+  e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->stdinPipe));
+  delete req;
+}
+
+void ChannelExec::AllocCallback (
+      uv_handle_t *handle
+    , size_t suggestedSize
+    , uv_buf_t *buf
+  ) {
+
+  buf->base = static_cast<char*>(malloc(suggestedSize));
+  buf->len = buf->base ? suggestedSize : 0;
+}
+
+void ChannelExec::ReadCallback (
+      uv_stream_t *stream
+    , ssize_t nread
+    , const uv_buf_t *buf
+  ) {
+
+  ChannelExec *e = static_cast<ChannelExec*>(stream->data);
+  bool isStderr = stream == reinterpret_cast<uv_stream_t*>(&e->stderrPipe);
+
+  if (nread > 0 && e->channel) {
+    // the channel frees it once it's been sent
+    e->channel->PeerOutput(buf->base, nread, isStderr);
+    if (!e->outputStopped && e->channel->QueuedLength() >= NSSH_EXEC_BUFFER) {
+      // the client isn't keeping up, leave it in the pipe for now
+      e->outputStopped = true;
+      if (!e->stdoutDone)
+        uv_read_stop(reinterpret_cast<uv_stream_t*>(&e->stdoutPipe));
+      if (!e->stderrDone)
+        uv_read_stop(reinterpret_cast<uv_stream_t*>(&e->stderrPipe));
+    }
+    return;
+  }
+
+  free(buf->base);
+  if (nread < 0) { // UV_EOF or an error, either way we're done with it
+    if (isStderr)
+      e->CloseOutput(&e->stderrPipe, &e->stderrDone);
+    else
+      e->CloseOutput(&e->stdoutPipe, &e->stdoutDone);
+    e->Finish();
+  }
+}
+
+void ChannelExec::OutputDrained () {
+  if (!outputStopped || !channel || channel->QueuedLength() >= NSSH_EXEC_BUFFER)
+    return;
+
+  outputStopped = false;
+  if (!stdoutDone) {
+    uv_read_start(
+        reinterpret_cast<uv_stream_t*>(&stdoutPipe)
+      , AllocCallback
+      , ReadCallback
+    );
+  }
+  if (!stderrDone) {
+    uv_read_start(
+        reinterpret_cast<uv_stream_t*>(&stderrPipe)
+      , AllocCallback
+      , ReadCallback
+    );
+  }
+}
+
+void ChannelExec::ExitCallback (
+      uv_process_t *handle
+    , int64_t exitStatus
+    , int termSignal
+  ) {
+
+  ChannelExec *e = static_cast<ChannelExec*>(handle->data);
+
+  if (NSSH_DEBUG)
+    std::cout << "ChannelExec exit " << exitStatus << " signal " << termSignal << std::endl;
+
+  e->exited = true;
+  e->exitStatus = exitStatus;
+  e->termSignal = termSignal;
+  e->CloseHandle(reinterpret_cast<uv_handle_t*>(&e->process));
+  e->Finish();
+}
+
+// the exit status goes once the child has gone and we have all its output
+void ChannelExec::Finish () {
+  if (!exited || !stdoutDone || !stderrDone)
+    return;
+
+  CloseStdin();
+  if (channel) {
+    Channel *c = channel;
+    channel = NULL;
+    c->ExecDone(exitStatus, termSignal);
+  }
+}
+
+void ChannelExec::Detach () {
+  channel = NULL;
+  if (!exited)
+    uv_process_kill(&process, SIGTERM);
+  if (!stdinClosed) {
+    stdinClosed = true;
+    CloseHandle(reinterpret_cast<uv_handle_t*>(&stdinPipe));
+  }
+  CloseOutput(&stdoutPipe, &stdoutDone);
+  CloseOutput(&stderrPipe, &stderrDone);
+}
+
+void ChannelExec::CloseOutput (uv_pipe_t *pipe, bool *done) {
+  if (*done)
+    return;
+  *done = true;
+  CloseHandle(reinterpret_cast<uv_handle_t*>(pipe));
+}
+
+void ChannelExec::CloseHandle (uv_handle_t *handle) {
+  uv_close(handle, ClosedCallback);
+}
+
+void ChannelExec::ClosedCallback (uv_handle_t *handle) {
+  ChannelExec *e = static_cast<ChannelExec*>(handle->data);
+  if (--e->handles == 0) {
+    if (NSSH_DEBUG)
+      std::cout << "ChannelExec done\n";
+    delete e;
+  }
+}
+
+#else // libuv 0.10's process and stream APIs aren't worth supporting here
+
+ChannelExec *ChannelExec::Spawn (
+      Channel *channel
+    , const char *cmd
+    , const char *cwd
+    , char **env
+    , std::string &error
+  ) {
+
+  error.assign("execNative() requires node 0.12 or later");
+  return NULL;
+}
+
+bool ChannelExec::Write (char *data, size_t length) {
+  free(data);
+  return true;
+}
+
+void ChannelExec::RemoteEof () {}
+void ChannelExec::OutputDrained () {}
+void ChannelExec::Detach () {}
+
+#endif
+
+} // namespace nssh
@@ -0,0 +1,86 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_CHANNEL_EXEC_H
+#define NSSH_CHANNEL_EXEC_H
+
+#include <node.h>
+#include <uv.h>
+#include <string>
+
+#include "nssh.h"
+#include "channel.h"
+
+namespace nssh {
+
+// a child process with its stdio connected to a Channel without going
+// through JS. Channel data is written to the child's stdin and its stdout
+// and stderr are queued on the channel, each side stops reading when the
+// other falls NSSH_EXEC_BUFFER behind. Owns its libuv handles and deletes
+// itself once they're all closed, which may be after the Channel is gone.
+class ChannelExec : public ChannelPeer {
+ public:
+  static ChannelExec *Spawn (
+      Channel *channel
+    , const char *cmd
+    , const char *cwd
+    , char **env
+    , std::string &error
+  );
+
+  bool Write (char *data, size_t length);
+  // the child gets an EOF on its stdin
+  void RemoteEof ();
+  void OutputDrained ();
+  // the child is killed if it's still running
+  void Detach ();
+
+ private:
+  ChannelExec (Channel *channel);
+
+  static void ExitCallback (
+      uv_process_t *handle
+    , int64_t exitStatus
+    , int termSignal
+  );
+  static void AllocCallback (
+      uv_handle_t *handle
+    , size_t suggestedSize
+    , uv_buf_t *buf
+  );
+  static void ReadCallback (
+      uv_stream_t *stream
+    , ssize_t nread
+    , const uv_buf_t *buf
+  );
+  static void WriteCallback (uv_write_t *req, int status);
+  static void ShutdownCallback (uv_shutdown_t *req, int status);
+  static void ClosedCallback (uv_handle_t *handle);
+
+  void CloseStdin ();
+  void CloseHandle (uv_handle_t *handle);
+  void CloseOutput (uv_pipe_t *pipe, bool *done);
+  void Finish ();
+
+  Channel *channel;
+  uv_process_t process;
+  uv_pipe_t stdinPipe;
+  uv_pipe_t stdoutPipe;
+  uv_pipe_t stderrPipe;
+  // handles still to be closed before we can go
+  int handles;
+  bool exited;
+  bool stdinClosed;
+  bool stdoutDone;
+  bool stderrDone;
+  bool inputStopped;
+  bool outputStopped;
+  size_t stdinQueued;
+  int64_t exitStatus;
+  int termSignal;
+};
+
+} // namespace nssh
+
+#endif
@@ -0,0 +1,253 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <stdlib.h>
+#include <fcntl.h>
+#include "file_sender.h"
+
+namespace nssh {
+
+#if UV_VERSION_MAJOR >= 1
+
+FileSender::FileSender (Channel *channel, NanCallback *callback) {
+  this->channel = channel;
+  this->callback = callback;
+  NanAssignPersistent(channelHandle, NanObjectWrapHandle(channel));
+  req.data = this;
+  fd = -1;
+  ownFd = false;
+  offset = 0;
+  remaining = -1;
+  sent = 0;
+  for (int i = 0; i < NSSH_SENDFILE_BUFFERS; i++) {
+    buffers[i] = static_cast<char*>(malloc(NSSH_SENDFILE_BUFFER_SIZE));
+    busy[i] = false;
+  }
+  readIndex = 0;
+  writing = 0;
+  reading = false;
+  queueing = false;
+  eof = false;
+  done = false;
+}
+
+FileSender::~FileSender () {
+  for (int i = 0; i < NSSH_SENDFILE_BUFFERS; i++)
+    free(buffers[i]);
+  NanDisposePersistent(channelHandle);
+  delete callback;
+}
+
+// either `path` is opened, or `fd` is used as it is and left open
+void FileSender::Start (
+      Channel *channel
+    , const char *path
+    , uv_file fd
+    , int64_t offset
+    , int64_t length
+    , NanCallback *callback
+  ) {
+
+  FileSender *f = new FileSender(channel, callback);
+  channel->StartFileSender(f);
+  f->offset = offset;
+  f->remaining = length;
+
+  if (!path) {
+    f->fd = fd;
+    f->Read();
+    f->Finish();
+    return;
+  }
+
+  int rc = uv_fs_open(
+      uv_default_loop()
+    , &f->req
+    , path
+    , O_RDONLY
+    , 0
+    , OpenCallback
+  );
+  if (rc < 0) {
+    f->Fail("Error opening file: ", rc);
+    f->Finish();
+  }
+}
+
+void FileSender::OpenCallback (uv_fs_t *req) {
+  FileSender *f = static_cast<FileSender*>(req->data);
+  int result = req->result;
+  uv_fs_req_cleanup(req);
+
+  if (result < 0) {
+    f->Fail("Error opening file: ", result);
+  } else {
+    f->fd = result;
+    f->ownFd = true;
+    f->Read();
+  }
+  f->Finish();
+}
+
+// one read at a time, into whichever buffer the channel isn't holding
+void FileSender::Read () {
+  if (reading || eof || !error.empty())
+    return;
+  if (remaining == 0) {
+    eof = true;
+    return;
+  }
+
+  int i = 0;
+  while (i < NSSH_SENDFILE_BUFFERS && busy[i])
+    i++;
+  if (i == NSSH_SENDFILE_BUFFERS)
+    return; // WriteDone() brings us back
+
+  size_t size = NSSH_SENDFILE_BUFFER_SIZE;
+  if (remaining > 0 && remaining < (int64_t)size)
+    size = remaining;
+
+  uv_buf_t buf = uv_buf_init(buffers[i], size);
+  readIndex = i;
+  reading = true;
+  int rc = uv_fs_read(
+      uv_default_loop()
+    , &req
+    , fd
+    , &buf
+    , 1
+    , offset
+    , ReadCallback
+  );
+  if (rc < 0) {
+    reading = false;
+    Fail("Error reading file: ", rc);
+  }
+}
+
+void FileSender::ReadCallback (uv_fs_t *req) {
+  FileSender *f = static_cast<FileSender*>(req->data);
+  ssize_t result = req->result;
+  uv_fs_req_cleanup(req);
+  f->reading = false;
+
+  if (result < 0) {
+    f->Fail("Error reading file: ", result);
+  } else if (result == 0) {
+    f->eof = true;
+  } else if (f->channel->IsClosed()) {
+    if (f->error.empty())
+      f->error.assign("Channel closed before the file was sent");
+  } else {
+    f->offset += result;
+    if (f->remaining > 0)
+      f->remaining -= result;
+    f->sent += result;
+    f->busy[f->readIndex] = true;
+    f->writing++;
+    // the channel may be able to send it straight away, WriteDone() is
+    // called from in here and leaves the rest to us
+    f->queueing = true;
+    f->channel->WriteNative(f->buffers[f->readIndex], result, f);
+    f->queueing = false;
+    f->Read();
+  }
+  f->Finish();
+}
+
+void FileSender::WriteDone (char *data, const char *error) {
+  for (int i = 0; i < NSSH_SENDFILE_BUFFERS; i++) {
+    if (buffers[i] == data)
+      busy[i] = false;
+  }
+  writing--;
+  if (error && this->error.empty())
+    this->error.assign(error);
+
+  if (queueing)
+    return;
+  Read();
+  Finish();
+}
+
+void FileSender::Detach () {
+  if (error.empty())
+    error.assign("Channel closed before the file was sent");
+  Finish();
+}
+
+void FileSender::Fail (const char *prefix, int err) {
+  if (!error.empty())
+    return;
+  error.assign(prefix);
+  error.append(uv_strerror(err));
+}
+
+// done once everything read has been sent or has failed, and nothing is
+// left with the threadpool
+void FileSender::Finish () {
+  if (done || reading || writing > 0 || (!eof && error.empty()))
+    return;
+  done = true;
+
+  if (NSSH_DEBUG)
+    std::cout << "FileSender::Finish sent=" << sent << std::endl;
+
+  if (ownFd) {
+    int rc = uv_fs_close(uv_default_loop(), &req, fd, CloseCallback);
+    if (rc == 0)
+      return;
+  }
+  Complete();
+}
+
+void FileSender::CloseCallback (uv_fs_t *req) {
+  FileSender *f = static_cast<FileSender*>(req->data);
+  uv_fs_req_cleanup(req);
+  f->Complete();
+}
+
+void FileSender::Complete () {
+  NanScope();
+
+  channel->FileSenderDone(this);
+
+  if (!error.empty()) {
+    v8::Local<v8::Value> argv[] = { NanError(error.c_str()) };
+    callback->Call(1, argv);
+  } else {
+    v8::Local<v8::Value> argv[] = {
+        NanNull()
+      , NanNew<v8::Number>(static_cast<double>(sent))
+    };
+    callback->Call(2, argv);
+  }
+  delete this;
+}
+
+#else // libuv 0.10's fs API isn't worth supporting here
+
+void FileSender::Start (
+      Channel *channel
+    , const char *path
+    , uv_file fd
+    , int64_t offset
+    , int64_t length
+    , NanCallback *callback
+  ) {
+
+  NanScope();
+
+  v8::Local<v8::Value> argv[] = {
+    NanError("sendFile() requires node 0.12 or later")
+  };
+  callback->Call(1, argv);
+  delete callback;
+}
+
+#endif
+
+} // namespace nssh
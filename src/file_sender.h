@@ -0,0 +1,74 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_FILE_SENDER_H
+#define NSSH_FILE_SENDER_H
+
+#include <node.h>
+#include <uv.h>
+#include <string>
+#include <nan.h>
+
+#include "nssh.h"
+#include "channel.h"
+
+namespace nssh {
+
+// sendFile(), a file read on the threadpool into a couple of buffers that
+// take turns going out on the channel as the remote window allows. The
+// callback gets the number of bytes sent once the last of them has gone.
+class FileSender : public ChannelWriter {
+ public:
+  static void Start (
+      Channel *channel
+    , const char *path
+    , uv_file fd
+    , int64_t offset
+    , int64_t length
+    , NanCallback *callback
+  );
+
+  void WriteDone (char *data, const char *error);
+  // the channel has closed, finish up without it
+  void Detach ();
+
+ private:
+  FileSender (Channel *channel, NanCallback *callback);
+  ~FileSender ();
+
+  static void OpenCallback (uv_fs_t *req);
+  static void ReadCallback (uv_fs_t *req);
+  static void CloseCallback (uv_fs_t *req);
+
+  void Read ();
+  void Fail (const char *prefix, int err);
+  void Finish ();
+  void Complete ();
+
+  Channel *channel;
+  // holds the channel for us until we're done
+  v8::Persistent<v8::Object> channelHandle;
+  NanCallback *callback;
+  uv_fs_t req;
+  uv_file fd;
+  bool ownFd;
+  int64_t offset;
+  // bytes left to read, -1 reads to the end of the file
+  int64_t remaining;
+  int64_t sent;
+  char *buffers[NSSH_SENDFILE_BUFFERS];
+  // a buffer is busy while it's with the channel
+  bool busy[NSSH_SENDFILE_BUFFERS];
+  int readIndex;
+  int writing;
+  bool reading;
+  bool queueing;
+  bool eof;
+  bool done;
+  std::string error;
+};
+
+} // namespace nssh
+
+#endif
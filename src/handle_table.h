@@ -0,0 +1,125 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_HANDLE_TABLE_H
+#define NSSH_HANDLE_TABLE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace nssh {
+
+// the SFTP handles given to a client, each is a slot index and the slot's
+// generation so a handle that has been closed doesn't find whatever gets
+// the slot next. Closed slots are reused from a free list, the table only
+// grows when there are none, up to `max` open at once.
+template <class T>
+class HandleTable {
+ public:
+  // the length of the handles we hand out
+  static const size_t kHandleLength = 8;
+
+  explicit HandleTable (size_t max) : max(max), count(0) {}
+
+  // fills in `handle`, false if `max` are already open
+  bool Add (T value, char *handle) {
+    uint32_t index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else if (slots.size() < max) {
+      index = slots.size();
+      Slot slot;
+      slot.generation = 0;
+      slots.push_back(slot);
+    } else {
+      return false;
+    }
+
+    slots[index].used = true;
+    slots[index].value = value;
+    count++;
+    Encode(handle, index);
+    Encode(handle + 4, slots[index].generation);
+    return true;
+  }
+
+  // NULL for anything we didn't hand out or that has been removed
+  T *Find (const char *handle, size_t length) {
+    Slot *slot = Lookup(handle, length);
+    return slot ? &slot->value : NULL;
+  }
+
+  bool Remove (const char *handle, size_t length) {
+    Slot *slot = Lookup(handle, length);
+    if (!slot)
+      return false;
+    slot->used = false;
+    slot->generation++;
+    freeSlots.push_back(slot - &slots[0]);
+    count--;
+    return true;
+  }
+
+  // for going through what's still open, At() is NULL for a free slot
+  size_t Slots () {
+    return slots.size();
+  }
+
+  T *At (size_t index) {
+    return slots[index].used ? &slots[index].value : NULL;
+  }
+
+  void Clear () {
+    slots.clear();
+    freeSlots.clear();
+    count = 0;
+  }
+
+  size_t Count () {
+    return count;
+  }
+
+ private:
+  struct Slot {
+    uint32_t generation;
+    bool used;
+    T value;
+  };
+
+  static void Encode (char *p, uint32_t value) {
+    p[0] = (char)(value >> 24);
+    p[1] = (char)(value >> 16);
+    p[2] = (char)(value >> 8);
+    p[3] = (char)value;
+  }
+
+  static uint32_t Decode (const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16)
+      | ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+  }
+
+  Slot *Lookup (const char *handle, size_t length) {
+    if (!handle || length != kHandleLength)
+      return NULL;
+    uint32_t index = Decode(handle);
+    if (index >= slots.size())
+      return NULL;
+    Slot *slot = &slots[index];
+    if (!slot->used || slot->generation != Decode(handle + 4))
+      return NULL;
+    return slot;
+  }
+
+  size_t max;
+  size_t count;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+};
+
+} // namespace nssh
+
+#endif
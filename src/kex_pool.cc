@@ -0,0 +1,139 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <libssh/server.h>
+#include "kex_pool.h"
+
+namespace nssh {
+
+KexKeyPool::KexKeyPool (int size) {
+  this->size = size;
+  fillWork = NULL;
+  destroyed = false;
+  hits = 0;
+  misses = 0;
+  for (int i = 0; i <= NSSH_KEX_KEYPAIR_TYPES; i++)
+    wanted[i] = false;
+  uv_mutex_init(&mutex);
+}
+
+KexKeyPool::~KexKeyPool () {
+  for (int i = 0; i <= NSSH_KEX_KEYPAIR_TYPES; i++) {
+    std::vector<ssh_kex_keypair>::iterator it = keypairs[i].begin();
+    while (it != keypairs[i].end())
+      ssh_kex_keypair_free(*it++);
+  }
+  uv_mutex_destroy(&mutex);
+}
+
+// called by libssh from the middle of a server kex, a miss just means the
+// session generates its own keypair inline like it always has
+ssh_kex_keypair KexKeyPool::TakeCallback (
+      ssh_session session
+    , int type
+    , void *userData
+  ) {
+
+  KexKeyPool* p = static_cast<KexKeyPool*>(userData);
+  return p->Take(type);
+}
+
+ssh_kex_keypair KexKeyPool::Take (int type) {
+  ssh_kex_keypair keypair = NULL;
+
+  if (type < 1 || type > NSSH_KEX_KEYPAIR_TYPES)
+    return NULL;
+
+  uv_mutex_lock(&mutex);
+  wanted[type] = true;
+  if (!keypairs[type].empty()) {
+    keypair = keypairs[type].back();
+    keypairs[type].pop_back();
+    hits++;
+  } else {
+    misses++;
+  }
+  uv_mutex_unlock(&mutex);
+
+  if (NSSH_DEBUG)
+    std::cout << "KexKeyPool::Take(" << type << ") "
+      << (keypair ? "hit" : "miss") << std::endl;
+
+  return keypair;
+}
+
+bool KexKeyPool::Wanted (int type) {
+  uv_mutex_lock(&mutex);
+  bool w = !destroyed && wanted[type] && keypairs[type].size() < size;
+  uv_mutex_unlock(&mutex);
+  return w;
+}
+
+// top up on the threadpool, a no-op if we're already full or filling
+void KexKeyPool::Fill () {
+  if (fillWork || destroyed)
+    return;
+
+  bool needed = false;
+  for (int i = 1; i <= NSSH_KEX_KEYPAIR_TYPES && !needed; i++)
+    needed = Wanted(i);
+  if (!needed)
+    return;
+
+  fillWork = new uv_work_t;
+  fillWork->data = this;
+  uv_queue_work(uv_default_loop(), fillWork, FillWork, FillWorkAfter);
+}
+
+// generate outside the lock so takers aren't held up
+bool KexKeyPool::Refill (int type) {
+  ssh_kex_keypair keypair = ssh_kex_keypair_new(type);
+  if (!keypair)
+    return false;
+
+  uv_mutex_lock(&mutex);
+  keypairs[type].push_back(keypair);
+  uv_mutex_unlock(&mutex);
+  return true;
+}
+
+void KexKeyPool::FillWork (uv_work_t *req) {
+  KexKeyPool* p = static_cast<KexKeyPool*>(req->data);
+
+  for (int i = 1; i <= NSSH_KEX_KEYPAIR_TYPES; i++) {
+    while (p->Wanted(i)) {
+      if (!p->Refill(i))
+        break;
+    }
+  }
+}
+
+void KexKeyPool::FillWorkAfter (uv_work_t *req, int status) {
+  KexKeyPool* p = static_cast<KexKeyPool*>(req->data);
+  delete req;
+  p->fillWork = NULL;
+
+  if (p->destroyed)
+    delete p;
+}
+
+void KexKeyPool::Stats (uint32_t &hits, uint32_t &misses) {
+  uv_mutex_lock(&mutex);
+  hits = this->hits;
+  misses = this->misses;
+  uv_mutex_unlock(&mutex);
+}
+
+// the server is done with us, wait for the threadpool if it has us
+void KexKeyPool::Destroy () {
+  uv_mutex_lock(&mutex);
+  destroyed = true;
+  uv_mutex_unlock(&mutex);
+
+  if (!fillWork)
+    delete this;
+}
+
+} // namespace nssh
@@ -0,0 +1,61 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_KEX_POOL_H
+#define NSSH_KEX_POOL_H
+
+#include <node.h>
+#include <uv.h>
+#include <libssh/server.h>
+#include <vector>
+
+#include "nssh.h"
+
+// highest ssh_kex_keypair_type_e
+#define NSSH_KEX_KEYPAIR_TYPES SSH_KEX_KEYPAIR_CURVE25519
+
+namespace nssh {
+
+// ephemeral kex keypairs generated on the threadpool ahead of time so a
+// handshake only has to do the shared secret and the signature, one list
+// per kex algorithm. Sessions take from it on whatever thread is running
+// their kex so everything here is behind the mutex.
+class KexKeyPool {
+ public:
+  KexKeyPool (int size);
+
+  static ssh_kex_keypair TakeCallback (
+      ssh_session session
+    , int type
+    , void *userData
+  );
+
+  void Fill ();
+  void Destroy ();
+  void Stats (uint32_t &hits, uint32_t &misses);
+
+ private:
+  ~KexKeyPool ();
+
+  static void FillWork (uv_work_t *req);
+  static void FillWorkAfter (uv_work_t *req, int status);
+
+  ssh_kex_keypair Take (int type);
+  bool Wanted (int type);
+  bool Refill (int type);
+
+  uv_mutex_t mutex;
+  uv_work_t *fillWork;
+  size_t size;
+  bool destroyed;
+  uint32_t hits;
+  uint32_t misses;
+  // only fill for algorithms clients have actually asked for
+  bool wanted[NSSH_KEX_KEYPAIR_TYPES + 1];
+  std::vector<ssh_kex_keypair> keypairs[NSSH_KEX_KEYPAIR_TYPES + 1];
+};
+
+} // namespace nssh
+
+#endif
@@ -7,12 +7,18 @@
 #include <libssh/keys.h>
 #include <libssh/sftp.h>
 #include <string.h>
+#include <unordered_map>
 #include "message.h"
+#include "session.h"
+#include "tcp_relay.h"
+#include "tcp_forward.h"
+#include "sftp_server.h"
 
 namespace nssh {
 
 const char* Message::MessageTypeToString (int type) {
   return type == SSH_REQUEST_AUTH ? "auth"
+    : type == SSH_REQUEST_CHANNEL_OPEN ? "channelopen"
     : type == SSH_REQUEST_CHANNEL ? "channel"
       : type == SSH_REQUEST_SERVICE ? "service"
         : type == SSH_REQUEST_GLOBAL ? "global"
@@ -87,15 +93,164 @@ const char* Message::MessageSubtypeToString (int type, int subtype) {
 }
 
 v8::Persistent<v8::FunctionTemplate> message_constructor;
+static v8::Persistent<v8::Function> message_function;
+
+enum {
+    kTypeField
+  , kSubtypeField
+  , kAuthUserField
+  , kAuthPasswordField
+  , kDestHostField
+  , kDestPortField
+  , kOriginHostField
+  , kOriginPortField
+  , kBindAddressField
+  , kBindPortField
+  , kExecCommandField
+  , kSubsystemField
+  , kPtyWidthField
+  , kPtyHeightField
+  , kPtyPxWidthField
+  , kPtyPxHeightField
+  , kPtyTermField
+  , kFieldCount
+};
+
+static v8::Persistent<v8::String> fieldSymbols[kFieldCount];
+static const char *fieldNames[kFieldCount] = {
+    "type"
+  , "subtype"
+  , "authUser"
+  , "authPassword"
+  , "destHost"
+  , "destPort"
+  , "originHost"
+  , "originPort"
+  , "bindAddress"
+  , "bindPort"
+  , "execCommand"
+  , "subsystem"
+  , "ptyWidth"
+  , "ptyHeight"
+  , "ptyPxWidth"
+  , "ptyPxHeight"
+  , "ptyTerm"
+};
+
+// type names are made once and shared by every message, they're all
+// literals from MessageTypeToString() / MessageSubtypeToString()
+static v8::Local<v8::String> TypeSymbol (const char *name) {
+  static std::unordered_map<const char*, v8::Persistent<v8::String>*> symbols;
+
+  v8::Persistent<v8::String> *&symbol = symbols[name];
+  if (!symbol) {
+    symbol = new v8::Persistent<v8::String>;
+    NanAssignPersistent(*symbol, NanNew<v8::String>(name));
+  }
+  return NanNew(*symbol);
+}
+
+static inline v8::Local<v8::Value> OptionalString (const char *str) {
+  if (!str)
+    return NanUndefined();
+  return NanNew<v8::String>(str);
+}
+
+// undefined for anything this kind of message doesn't have
+static v8::Local<v8::Value> FieldValue (ssh_message message, int field) {
+  int type = ssh_message_type(message);
+  int subtype = ssh_message_subtype(message);
+  bool directTcpip = type == SSH_REQUEST_CHANNEL_OPEN
+    && subtype == SSH_CHANNEL_DIRECT_TCPIP;
+  bool pty = type == SSH_REQUEST_CHANNEL
+    && (subtype == SSH_CHANNEL_REQUEST_PTY
+      || subtype == SSH_CHANNEL_REQUEST_WINDOW_CHANGE);
+  bool ptyRequest = type == SSH_REQUEST_CHANNEL
+    && subtype == SSH_CHANNEL_REQUEST_PTY;
+
+  switch (field) {
+    case kTypeField:
+      return TypeSymbol(Message::MessageTypeToString(type));
+    case kSubtypeField:
+      return TypeSymbol(Message::MessageSubtypeToString(type, subtype));
+    case kAuthUserField:
+      if (type == SSH_REQUEST_AUTH)
+        return OptionalString(ssh_message_auth_user(message));
+      break;
+    case kAuthPasswordField:
+      if (type == SSH_REQUEST_AUTH)
+        return OptionalString(ssh_message_auth_password(message));
+      break;
+    case kDestHostField:
+      if (directTcpip)
+        return OptionalString(ssh_message_channel_request_open_destination(message));
+      break;
+    case kDestPortField:
+      if (directTcpip)
+        return NanNew<v8::Integer>(ssh_message_channel_request_open_destination_port(message));
+      break;
+    case kOriginHostField:
+      if (directTcpip)
+        return OptionalString(ssh_message_channel_request_open_originator(message));
+      break;
+    case kOriginPortField:
+      if (directTcpip)
+        return NanNew<v8::Integer>(ssh_message_channel_request_open_originator_port(message));
+      break;
+    case kBindAddressField:
+      if (type == SSH_REQUEST_GLOBAL)
+        return OptionalString(ssh_message_global_request_address(message));
+      break;
+    case kBindPortField:
+      if (type == SSH_REQUEST_GLOBAL)
+        return NanNew<v8::Integer>(ssh_message_global_request_port(message));
+      break;
+    case kExecCommandField:
+      if (type == SSH_REQUEST_CHANNEL && subtype == SSH_CHANNEL_REQUEST_EXEC)
+        return OptionalString(ssh_message_channel_request_command(message));
+      break;
+    case kSubsystemField:
+      if (type == SSH_REQUEST_CHANNEL && subtype == SSH_CHANNEL_REQUEST_SUBSYSTEM)
+        return OptionalString(ssh_message_channel_request_subsystem(message));
+      break;
+    case kPtyWidthField:
+      if (pty)
+        return NanNew<v8::Integer>(ssh_message_channel_request_pty_width(message));
+      break;
+    case kPtyHeightField:
+      if (pty)
+        return NanNew<v8::Integer>(ssh_message_channel_request_pty_height(message));
+      break;
+    case kPtyPxWidthField:
+      if (ptyRequest)
+        return NanNew<v8::Integer>(ssh_message_channel_request_pty_pxwidth(message));
+      break;
+    case kPtyPxHeightField:
+      if (ptyRequest)
+        return NanNew<v8::Integer>(ssh_message_channel_request_pty_pxheight(message));
+      break;
+    case kPtyTermField:
+      if (ptyRequest)
+        return OptionalString(ssh_message_channel_request_pty_term(message));
+      break;
+  }
+
+  return NanUndefined();
+}
 
 Message::Message () {
+  message = NULL;
+  replied = false;
+  owned = false;
+  kept = NULL;
 }
 
 Message::~Message () {
-  //TODO: GC is knocking this off too quick, either need to figure out
-  // if libssh is doing this for us or protect Message from GC until
-  // it's no longer needed -- what's the trigger for this?
-  //ssh_message_free(message);
+  if (kept)
+    ssh_message_free(kept);
+  else if (owned && message)
+    ssh_message_free(message);
+  NanDisposePersistent(fields);
 }
 
 void Message::Init () {
@@ -104,88 +259,100 @@ void Message::Init () {
   v8::Local<v8::FunctionTemplate> tpl = NanNew<v8::FunctionTemplate>(New);
   NanAssignPersistent(message_constructor, tpl);
   tpl->SetClassName(NanNew<v8::String>("Message"));
-  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  v8::Local<v8::ObjectTemplate> instance = tpl->InstanceTemplate();
+  instance->SetInternalFieldCount(1);
+  for (int i = 0; i < kFieldCount; i++) {
+    NanAssignPersistent(fieldSymbols[i], NanNew<v8::String>(fieldNames[i]));
+    instance->SetAccessor(
+        NanNew(fieldSymbols[i])
+      , GetField
+      , 0
+      , NanNew<v8::Integer>(i)
+    );
+  }
+
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyDefault", ReplyDefault);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyAuthSuccess", ReplyAuthSuccess);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replySuccess", ReplySuccess);
   NODE_SET_PROTOTYPE_METHOD(tpl, "comparePublicKey", ComparePublicKey);
   NODE_SET_PROTOTYPE_METHOD(tpl, "scpAccept", ScpAccept);
   NODE_SET_PROTOTYPE_METHOD(tpl, "sftpAccept", SftpAccept);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "replyForward", ReplyForward);
+
+  NanAssignPersistent(message_function, tpl->GetFunction());
 }
 
 v8::Handle<v8::Object> Message::NewInstance (
       ssh_session session
     , Channel *channel
-    , ssh_message message) {
+    , ssh_message message
+    , Session *parent
+    , bool owned) {
 
   NanEscapableScope();
 
   if (NSSH_DEBUG)
     std::cout << "Message::NewInstance\n";
 
-  v8::Local<v8::FunctionTemplate> constructorHandle = NanNew(message_constructor);
   v8::Local<v8::Object> instance =
-      constructorHandle->GetFunction()->NewInstance(0, NULL);
+      NanNew(message_function)->NewInstance(0, NULL);
 
   Message *m = ObjectWrap::Unwrap<Message>(instance);
   m->session = session;
   m->channel = channel;
   m->message = message;
+  m->parent = parent;
+  m->owned = owned;
 
   if (NSSH_DEBUG)
     std::cout << "Message::NewInstance got instance\n";
 
-  int type = ssh_message_type(message);
-  int subtype = ssh_message_subtype(message);
-  const char *typeStr = MessageTypeToString(type);
-  const char *subtypeStr = MessageSubtypeToString(type, subtype);
-
-  instance->Set(NanNew<v8::String>("type"), typeStr == NULL
-    ? NanNull()->ToObject()
-    : NanNew<v8::String>(typeStr)->ToObject()
-  );
-  instance->Set(NanNew<v8::String>("subtype"), subtypeStr == NULL
-    ? NanNull()->ToObject()
-    : NanNew<v8::String>(subtypeStr)->ToObject()
-  );
-
-  if (type == SSH_REQUEST_AUTH) {
-    const char *authUser = ssh_message_auth_user(message);
-    if (authUser)
-      instance->Set(NanNew<v8::String>("authUser"), NanNew<v8::String>(authUser));
-    const char *authPassword = ssh_message_auth_password(message);
-    if (authPassword)
-      instance->Set(NanNew<v8::String>("authPassword"), NanNew<v8::String>(authPassword));
-  } else if (type == SSH_REQUEST_CHANNEL) {
-    if (subtype == SSH_CHANNEL_REQUEST_EXEC) {
-      const char *execCommand = ssh_message_channel_request_command(message);
-      if (execCommand)
-        instance->Set(NanNew<v8::String>("execCommand"), NanNew<v8::String>(execCommand));
-    } else if (subtype == SSH_CHANNEL_REQUEST_SUBSYSTEM) {
-      const char *subsystem = ssh_message_channel_request_subsystem(message);
-      if (subsystem) 
-        instance->Set(NanNew<v8::String>("subsystem"), NanNew<v8::String>(subsystem));
-    } else if (subtype == SSH_CHANNEL_REQUEST_PTY) {
-      instance->Set(NanNew<v8::String>("ptyWidth"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_width(message)));
-      instance->Set(NanNew<v8::String>("ptyHeight"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_height(message)));
-      instance->Set(NanNew<v8::String>("ptyPxWidth"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_pxwidth(message)));
-      instance->Set(NanNew<v8::String>("ptyPxHeight"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_pxheight(message)));
-      const char *term = ssh_message_channel_request_pty_term(message);
-      if (term)
-        instance->Set(NanNew<v8::String>("ptyTerm"), NanNew<v8::String>(term));
-    } else if (subtype == SSH_CHANNEL_REQUEST_WINDOW_CHANGE) {
-      instance->Set(NanNew<v8::String>("ptyWidth"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_width(message)));
-      instance->Set(NanNew<v8::String>("ptyHeight"),
-          NanNew<v8::Integer>(ssh_message_channel_request_pty_height(message)));
+  return NanEscapeScope(instance);
+}
+
+// properties are read from the libssh message when they're asked for, or
+// from what was copied of it if it wasn't ours to keep
+NAN_GETTER(Message::GetField) {
+  NanScope();
+
+  Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
+  ssh_message message = m->message ? m->message : m->kept;
+  if (message)
+    NanReturnValue(FieldValue(message, args.Data()->Int32Value()));
+  if (!m->fields.IsEmpty())
+    NanReturnValue(NanNew(m->fields)->Get(property));
+
+  NanReturnUndefined();
+}
+
+void Message::Expire (v8::Handle<v8::Object> instance) {
+  Message *m = ObjectWrap::Unwrap<Message>(instance);
+  if (m->message && !m->replied)
+    ssh_message_reply_default(m->message);
+  Release(instance);
+}
+
+void Message::Release (v8::Handle<v8::Object> instance) {
+  NanScope();
+
+  Message *m = ObjectWrap::Unwrap<Message>(instance);
+  if (!m->message)
+    return;
+
+  if (m->owned) {
+    // nothing to copy, it's freed along with us
+    m->kept = m->message;
+  } else {
+    v8::Local<v8::Object> fields = NanNew<v8::Object>();
+    for (int i = 0; i < kFieldCount; i++) {
+      v8::Local<v8::Value> value = FieldValue(m->message, i);
+      if (!value->IsUndefined())
+        fields->Set(NanNew(fieldSymbols[i]), value);
     }
+    NanAssignPersistent(m->fields, fields);
   }
-
-  return NanEscapeScope(instance);
+  m->message = NULL;
 }
 
 NAN_METHOD(Message::New) {
@@ -205,7 +372,10 @@ NAN_METHOD(Message::ReplyDefault) {
 
   //TODO: async
   Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
+  if (!m->message)
+    return NanThrowError("Message has already been replied to");
   ssh_message_reply_default(m->message);
+  m->replied = true;
 
   NanReturnUndefined();
 }
@@ -215,7 +385,10 @@ NAN_METHOD(Message::ReplySuccess) {
 
   //TODO: async
   Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
+  if (!m->message)
+    return NanThrowError("Message has already been replied to");
   ssh_message_channel_request_reply_success(m->message);
+  m->replied = true;
 
   NanReturnUndefined();
 }
@@ -226,6 +399,7 @@ NAN_METHOD(Message::ReplyAuthSuccess) {
   //TODO: async
   Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
   ssh_message_auth_reply_success(m->message, 0);
+  m->replied = true;
 
   NanReturnUndefined();
 }
@@ -269,6 +443,11 @@ NAN_METHOD(Message::ComparePublicKey) {
   NanReturnValue(cmp == 0 ? NanTrue() : NanFalse());
 }
 
+// switch the channel to SFTP, requests come to JS as 'sftp:X' events
+// unless a `root` directory is given in the options, then the binding
+// serves them from there itself, asking an optional `filter` function
+// about each path first. `maxHandles` caps the files and directories the
+// client can have open.
 NAN_METHOD(Message::SftpAccept) {
   NanScope();
 
@@ -277,8 +456,98 @@ NAN_METHOD(Message::SftpAccept) {
 
   Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
 
+  SftpServer *server = NULL;
+  size_t maxHandles = NSSH_SFTP_MAX_HANDLES;
+  if (args[0]->IsObject()) {
+    v8::Local<v8::Object> options = args[0].As<v8::Object>();
+    v8::Local<v8::Value> max = options->Get(NanNew<v8::String>("maxHandles"));
+    if (max->IsNumber() && max->IntegerValue() > 0)
+      maxHandles = max->IntegerValue();
+    v8::Local<v8::Value> root = options->Get(NanNew<v8::String>("root"));
+    if (!root->IsUndefined()) {
+      std::string error;
+      server = SftpServer::New(
+          *v8::String::Utf8Value(root)
+        , options->Get(NanNew<v8::String>("filter"))
+        , maxHandles
+        , error
+      );
+      if (!server)
+        return NanThrowError(error.c_str());
+    }
+  }
+
   sftp_session sftp = sftp_server_new(m->session, m->channel->channel);
-  m->channel->SetSftp(sftp);
+  m->channel->SetSftp(sftp, server, maxHandles);
+
+  NanReturnUndefined();
+}
+
+// allow a directtcpip channel, the binding connects to the destination
+// (or `host` and `port` if given) and relays the channel to it natively.
+// The client's open is only accepted once the connection is made.
+// For a tcpipforward the binding listens on the requested address (or
+// `host` and `port`) and relays every connection to a new channel,
+// returns false and refuses the client if it can't listen.
+NAN_METHOD(Message::ReplyForward) {
+  NanScope();
+
+  Message* m = node::ObjectWrap::Unwrap<Message>(args.This());
+  if (!m->message)
+    return NanThrowError("Message has already been replied to");
+
+  int type = ssh_message_type(m->message);
+  int subtype = ssh_message_subtype(m->message);
+  v8::String::Utf8Value hostArg(args[0]);
+
+  if (m->parent && type == SSH_REQUEST_GLOBAL
+      && subtype == SSH_GLOBAL_REQUEST_TCPIP_FORWARD) {
+    const char *address = ssh_message_global_request_address(m->message);
+    int port = ssh_message_global_request_port(m->message);
+    std::string error;
+    TcpForward *forward = TcpForward::Listen(
+        m->parent
+      , m->session
+      , address
+      , port
+      , args[0]->IsString() ? *hostArg : address
+      , args[1]->IsNumber() ? args[1]->Int32Value() : port
+      , error
+    );
+
+    m->replied = true;
+    if (!forward) {
+      if (NSSH_DEBUG)
+        std::cout << error << std::endl;
+      ssh_message_reply_default(m->message);
+      NanReturnValue(NanFalse());
+    }
+
+    m->parent->AddForward(forward);
+    ssh_message_global_request_reply_success(m->message, forward->Port());
+    NanReturnValue(NanTrue());
+  }
+
+  if (!m->parent || type != SSH_REQUEST_CHANNEL_OPEN
+      || subtype != SSH_CHANNEL_DIRECT_TCPIP) {
+    return NanThrowError(
+        "replyForward() is only for directtcpip and tcpipforward messages");
+  }
+
+  const char *host = args[0]->IsString()
+    ? *hostArg
+    : ssh_message_channel_request_open_destination(m->message);
+  int port = args[1]->IsNumber()
+    ? args[1]->Int32Value()
+    : ssh_message_channel_request_open_destination_port(m->message);
+  if (!host)
+    return NanThrowError("replyForward() has no host to connect to");
+
+  // the relay owns the message now
+  ssh_message message = m->message;
+  m->owned = false;
+  Release(args.This());
+  TcpRelay::Connect(m->parent, message, host, port);
 
   NanReturnUndefined();
 }
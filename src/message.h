@@ -15,6 +15,8 @@
 
 namespace nssh {
 
+class Session;
+
 class Message : public node::ObjectWrap {
  public:
   static void Init ();
@@ -22,26 +24,45 @@ class Message : public node::ObjectWrap {
       ssh_session session
     , Channel *channel
     , ssh_message message
+    , Session *parent = NULL
+    , bool owned = true
   );
   static const char* MessageTypeToString (int type);
   static const char* MessageSubtypeToString (int type, int subtype);
+  // libssh is about to free the message, refuse it if JS hasn't answered
+  static void Expire (v8::Handle<v8::Object> instance);
+  // no more replies, the message's properties can still be read
+  static void Release (v8::Handle<v8::Object> instance);
 
   Message ();
   ~Message ();
 
  private:
 
+  // NULL once it can't be replied to
   ssh_message message;
+  bool replied;
+  // we free the message on ~Message(), otherwise libssh or a TcpRelay
+  // does and its properties are copied into `fields` on Release()
+  bool owned;
+  // an owned message after Release(), still read for properties
+  ssh_message kept;
   ssh_session session;
   Channel *channel;
+  // the Session for session level messages
+  Session *parent;
+  // what was read from a message that isn't ours before it went
+  v8::Persistent<v8::Object> fields;
 
   static NAN_METHOD(New);
+  static NAN_GETTER(GetField);
   static NAN_METHOD(ReplyDefault);
   static NAN_METHOD(ReplyAuthSuccess);
   static NAN_METHOD(ReplySuccess);
   static NAN_METHOD(ComparePublicKey);
   static NAN_METHOD(ScpAccept);
   static NAN_METHOD(SftpAccept);
+  static NAN_METHOD(ReplyForward);
 };
 
 } // namespace nssh
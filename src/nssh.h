@@ -9,4 +9,65 @@
 #define NSSH_DEBUG false
 //#define cout cerr
 
+// how much a channel may read each time the session gets round to it, the
+// rest waits for the next pass so one busy channel can't starve the others
+#define NSSH_CHANNEL_READ_BUDGET (64 * 1024)
+#define NSSH_SFTP_MESSAGE_BUDGET 64
+
+// channel reads land in shared slabs of this size, JS gets slices
+#define NSSH_SLAB_SIZE (64 * 1024)
+
+// how far either side of an execNative() child may get ahead of the other
+#define NSSH_EXEC_BUFFER (256 * 1024)
+// and for either end of a forwarded TCP connection
+#define NSSH_RELAY_BUFFER (256 * 1024)
+
+// milliseconds a session gets to finish its initial key exchange, unless
+// createServer() is given a `handshakeTimeout`
+#define NSSH_HANDSHAKE_TIMEOUT (120 * 1000)
+
+// sendFile() reads into one buffer while the other is with the channel
+#define NSSH_SENDFILE_BUFFERS 2
+#define NSSH_SENDFILE_BUFFER_SIZE (64 * 1024)
+
+// a native SFTP root stops taking requests while this much of its replies
+// is waiting on the client's window
+#define NSSH_SFTP_BUFFER (1024 * 1024)
+// requests it has on the threadpool at once, clients keep plenty in flight
+#define NSSH_SFTP_MAX_REQUESTS 64
+// the most a single READ is answered with, clients ask for less anyway
+#define NSSH_SFTP_MAX_READ (64 * 1024)
+// files and directories an SFTP client can have open, unless sftpAccept()
+// is given a `maxHandles`
+#define NSSH_SFTP_MAX_HANDLES 65536
+// entries in each READDIR reply
+#define NSSH_SFTP_READDIR_COUNT 64
+
+// libuv 0.10 handle callbacks take a status, later versions don't
+#if UV_VERSION_MAJOR == 0
+#define NSSH_IDLE_CALLBACK(name) void name (uv_idle_t *handle, int status)
+#define NSSH_TIMER_CALLBACK(name) void name (uv_timer_t *handle, int status)
+#else
+#define NSSH_IDLE_CALLBACK(name) void name (uv_idle_t *handle)
+#define NSSH_TIMER_CALLBACK(name) void name (uv_timer_t *handle)
+#endif
+
+namespace nssh {
+
+// picks a function up off the object handed to a setCallbacks() binding,
+// the handle is kept so events don't need a property lookup each time
+static inline void SetCallback (
+      v8::Persistent<v8::Function> &callback
+    , v8::Handle<v8::Object> callbacks
+    , v8::Persistent<v8::String> &name
+  ) {
+
+  v8::Local<v8::Value> fn = callbacks->Get(NanNew(name));
+  NanDisposePersistent(callback);
+  if (fn->IsFunction())
+    NanAssignPersistent(callback, fn.As<v8::Function>());
+}
+
+} // namespace nssh
+
 #endif
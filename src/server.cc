@@ -7,20 +7,26 @@
 #include <libssh/keys.h>
 #include <libssh/callbacks.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "server.h"
 #include "session.h"
 
 namespace nssh {
 
 static v8::Persistent<v8::FunctionTemplate> server_constructor;
+static v8::Persistent<v8::String> onConnection_symbol;
 
 NAN_METHOD(Server::NewInstance) {
   NanScope();
 
   v8::Local<v8::Object> instance;
   v8::Local<v8::FunctionTemplate> constructorHandle = NanNew(server_constructor);
-  v8::Handle<v8::Value> argv[] = { args[0], args[1], args[2], args[3], args[4]};
-  instance = constructorHandle->GetFunction()->NewInstance(5, argv);
+  v8::Handle<v8::Value> argv[] = {
+    args[0], args[1], args[2], args[3], args[4], args[5]
+  };
+  instance = constructorHandle->GetFunction()->NewInstance(6, argv);
 
   NanReturnValue(instance);
 }
@@ -34,19 +40,107 @@ void Server::SocketPollCallback (uv_poll_t* handle, int status, int events) {
     std::cout << "SocketPollCallback... " << status << ", " << events
       << std::endl;
 
-  ssh_session session = ssh_new();
+  int accepted = 0;
+  int failed = 0;
+
+  // drain the listen queue until it would block, but don't hog the loop
+  // for more than acceptBudget connections per wakeup
+  while (s->running && accepted + failed < s->acceptBudget) {
+    if (!s->nextSession)
+      s->nextSession = ssh_new();
+
+    int accept = ssh_bind_accept(s->sshbind, s->nextSession);
+
+    if (accept == SSH_AGAIN) // session untouched, keep it for next time
+      break;
+
+    if (accept == SSH_ERROR) {
+      if (NSSH_DEBUG)
+        std::cout << "accept failed: " << accept << ", "
+          << ssh_get_error(s->sshbind) << std::endl;
+      ssh_free(s->nextSession);
+      s->nextSession = NULL;
+      failed++;
+      continue;
+    }
 
-  int accept = ssh_bind_accept(s->sshbind, session);
-  if (accept != SSH_ERROR) {
     if (NSSH_DEBUG) std::cout << "SocketPollCallback:ssh_bind_accept()\n";
-    v8::Handle<v8::Object> sess = Session::NewInstance(session);
-    s->OnConnection(sess);
-    node::ObjectWrap::Unwrap<Session>(sess)->Start();
-  } else {
+    ssh_session session = s->nextSession;
+    s->nextSession = NULL;
+    accepted++;
+    s->StartSession(session);
+  }
+
+  s->acceptedCount += accepted;
+  s->acceptFailedCount += failed;
+
+  if (NSSH_DEBUG)
+    std::cout << "SocketPollCallback accepted=" << accepted
+      << ", failed=" << failed << std::endl;
+}
+
+void Server::StartSession (ssh_session session) {
+  NanScope();
+
+  if (!HandshakeSlotFree() && maxPendingHandshakes >= 0
+      && handshakeQueue.size() >= (size_t)maxPendingHandshakes) {
+    // full up, turn them away before anything is spent on them
+    ssh_server_reject(session);
+    ssh_free(session);
+    handshakesRejectedCount++;
     if (NSSH_DEBUG)
-      std::cout << "accept failed: " << accept << ", "
-        << ssh_get_error(s->sshbind) << std::endl;
+      std::cout << "StartSession rejected, " << handshakesActive
+        << " handshaking, " << handshakeQueue.size() << " queued\n";
+    return;
   }
+
+  v8::Handle<v8::Object> sess =
+      Session::NewInstance(session, HandshakeDoneCallback, this);
+  OnConnection(sess);
+
+  Session *s = node::ObjectWrap::Unwrap<Session>(sess);
+  if (!HandshakeSlotFree()) {
+    s->Queue();
+    handshakeQueue.push_back(s);
+    return;
+  }
+
+  handshakesActive++;
+  if (!s->Start(offloadKex, kexKeyPool, handshakeTimeout))
+    handshakesActive--; // closed from the 'connection' event
+
+  if (kexKeyPool)
+    kexKeyPool->Fill();
+}
+
+bool Server::HandshakeSlotFree () {
+  return maxConcurrentHandshakes <= 0
+    || handshakesActive < maxConcurrentHandshakes;
+}
+
+// first in, first out, skipping sessions that were closed while they waited
+void Server::StartHandshakes () {
+  while (!handshakeQueue.empty() && HandshakeSlotFree()) {
+    Session *s = handshakeQueue.front();
+    handshakeQueue.pop_front();
+    handshakesActive++;
+    if (!s->Start(offloadKex, kexKeyPool, handshakeTimeout))
+      handshakesActive--;
+  }
+}
+
+void Server::HandshakeDoneCallback (Session *session, void *userData) {
+  Server* s = static_cast<Server*>(userData);
+
+  s->handshakesActive--;
+  if (NSSH_DEBUG)
+    std::cout << "HandshakeDoneCallback, " << s->handshakesActive
+      << " handshaking, " << s->handshakeQueue.size() << " queued\n";
+  s->StartHandshakes();
+
+  // top up whatever that handshake took from the pool
+  if (s->kexKeyPool)
+    s->kexKeyPool->Fill();
 }
 
 void IncomingConnectionCallback (ssh_bind sshbind, void *userdata) {
@@ -55,6 +149,20 @@ void IncomingConnectionCallback (ssh_bind sshbind, void *userdata) {
 
 Server::Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char *banner) {
   running = false;
+  offloadKex = false;
+  reusePort = false;
+  sshbind = NULL;
+  poll_handle = NULL;
+  acceptBudget = NSSH_ACCEPT_BUDGET;
+  maxConcurrentHandshakes = 0;
+  maxPendingHandshakes = -1;
+  handshakesActive = 0;
+  handshakeTimeout = NSSH_HANDSHAKE_TIMEOUT;
+  handshakesRejectedCount = 0;
+  kexKeyPool = NULL;
+  nextSession = NULL;
+  acceptedCount = 0;
+  acceptFailedCount = 0;
 
   if (ssh_init()) {
     std::cerr << "ERROR: ssh_init failed";
@@ -63,6 +171,8 @@ Server::Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char
 
   this->port = port;
   this->addr = addr;
+  rsaHostKeyFile.assign(rsaHostKey);
+  dsaHostKeyFile.assign(dsaHostKey);
 
   if (NSSH_DEBUG)
     std::cerr << "Server::Server running=false " << addr << ":" << port << "\n";
@@ -70,8 +180,10 @@ Server::Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char
   sshbind = ssh_bind_new();
   ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_RSAKEY, rsaHostKey);
   ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_DSAKEY, dsaHostKey);
-  ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDADDR, addr);
-  ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDPORT_STR, port);
+  if (port) { // NULL when we're only handed sockets via HandleSocket()
+    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDADDR, addr);
+    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BINDPORT_STR, port);
+  }
   ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_BANNER, banner);
   //delete rsaHostKey;
   //delete dsaHostKey;
@@ -85,13 +197,25 @@ Server::Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char
     );
 
   ssh_bind_set_blocking(sshbind, 0);
+}
+
+bool Server::Listen (std::string &error) {
+  if (!sshbind) {
+    error.assign("ssh_init failed");
+    return false;
+  }
+
+  if (reusePort) {
+    int on = 1;
+    ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_REUSEPORT, &on);
+  }
 
   if (ssh_bind_listen(sshbind) < 0) {
-    //TODO:
-    std::cerr << "ERROR: listening to socket: " << ssh_get_error(sshbind)
-        << std::endl;
+    error.assign("Error listening to socket: ");
+    error.append(ssh_get_error(sshbind));
     ssh_bind_free(sshbind);
-    exit(-1); // eww... fix this
+    sshbind = NULL;
+    return false;
   }
 
   assert(ssh_bind_get_fd(sshbind) > 0);
@@ -111,14 +235,17 @@ Server::Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char
   uv_poll_start(poll_handle, UV_READABLE, Server::SocketPollCallback);
   running = true;
   if (NSSH_DEBUG)
-    std::cerr << "Server::Server running=true " << addr << ":" << port << "\n";
+    std::cerr << "Server::Listen running=true " << addr << ":" << port << "\n";
 
-  if (NSSH_DEBUG) std::cout << "Server::Server done\n";
+  if (NSSH_DEBUG) std::cout << "Server::Listen done\n";
+  return true;
 }
 
 Server::~Server () {
   if (NSSH_DEBUG)
     std::cout << "****************** ~SERVER ******************\n";
+  if (kexKeyPool)
+    kexKeyPool->Destroy();
 }
 
 void Server::Close () {
@@ -129,8 +256,22 @@ void Server::Close () {
     if (NSSH_DEBUG)
       std::cerr << "Server::Close running=false " << addr << ":" << port << "\n";
     //std::cerr << "+++ Server::Close running=false " << port << ", " << poll_handle->loop << "\n";
-    uv_poll_stop(poll_handle);
-    delete poll_handle;
+    if (poll_handle) {
+      uv_poll_stop(poll_handle);
+      delete poll_handle;
+      poll_handle = NULL;
+    }
+    if (nextSession) {
+      ssh_free(nextSession);
+      nextSession = NULL;
+    }
+    // nothing is going to give the queue a handshake slot now
+    while (!handshakeQueue.empty()) {
+      Session *session = handshakeQueue.front();
+      handshakeQueue.pop_front();
+      session->Reject();
+      handshakesRejectedCount++;
+    }
     ssh_bind_free(sshbind);
     if (NSSH_DEBUG)
       std::cerr << "Server::Close ssh_bind_free\n";
@@ -146,12 +287,10 @@ void Server::Close () {
 void Server::OnConnection (v8::Handle<v8::Object> session) {
   NanScope();
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onConnection"));
-  if (callback->IsFunction()) {
+  if (!onConnection.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = { session };
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onConnection)->Call(NanObjectWrapHandle(this), 1, argv);
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
   }
@@ -165,6 +304,12 @@ void Server::Init () {
   tpl->SetClassName(NanNew<v8::String>("Server"));
   tpl->InstanceTemplate()->SetInternalFieldCount(1);
   NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "reloadHostKeys", ReloadHostKeys);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "handleSocket", HandleSocket);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "setCallbacks", SetCallbacks);
+
+  NanAssignPersistent(onConnection_symbol, NanNew<v8::String>("onConnection"));
 }
 
 NAN_METHOD(Server::New) {
@@ -179,9 +324,51 @@ NAN_METHOD(Server::New) {
   v8::String::Utf8Value dsaHostKey(args[3]);
   v8::String::Utf8Value banner(args[4]);
 
-  Server* obj = new Server(*port, *addr, *rsaHostKey, *dsaHostKey, *banner);
+  // a null port gives us a server that only takes sockets from HandleSocket()
+  bool listen = !args[0]->IsNull() && !args[0]->IsUndefined();
+
+  Server* obj = new Server(
+      listen ? *port : NULL, *addr, *rsaHostKey, *dsaHostKey, *banner);
   obj->Wrap(args.This());
 
+  if (args[5]->IsObject()) {
+    v8::Local<v8::Object> options = args[5].As<v8::Object>();
+    obj->offloadKex =
+        options->Get(NanNew<v8::String>("offloadKex"))->BooleanValue();
+    v8::Local<v8::Value> acceptBudget =
+        options->Get(NanNew<v8::String>("acceptBudget"));
+    if (acceptBudget->IsNumber() && acceptBudget->Int32Value() > 0)
+      obj->acceptBudget = acceptBudget->Int32Value();
+    obj->reusePort =
+        options->Get(NanNew<v8::String>("reusePort"))->BooleanValue();
+    v8::Local<v8::Value> maxConcurrent =
+        options->Get(NanNew<v8::String>("maxConcurrentHandshakes"));
+    if (maxConcurrent->IsNumber() && maxConcurrent->Int32Value() > 0)
+      obj->maxConcurrentHandshakes = maxConcurrent->Int32Value();
+    v8::Local<v8::Value> maxPending =
+        options->Get(NanNew<v8::String>("maxPendingHandshakes"));
+    if (maxPending->IsNumber() && maxPending->Int32Value() >= 0)
+      obj->maxPendingHandshakes = maxPending->Int32Value();
+    v8::Local<v8::Value> handshakeTimeout =
+        options->Get(NanNew<v8::String>("handshakeTimeout"));
+    if (handshakeTimeout->IsNumber() && handshakeTimeout->NumberValue() >= 0)
+      obj->handshakeTimeout = handshakeTimeout->Uint32Value();
+    v8::Local<v8::Value> kexKeyPool =
+        options->Get(NanNew<v8::String>("kexKeyPool"));
+    if (kexKeyPool->IsNumber() && kexKeyPool->Int32Value() > 0)
+      obj->kexKeyPool = new KexKeyPool(kexKeyPool->Int32Value());
+  }
+
+  std::string err;
+  if (listen) {
+    if (!obj->Listen(err))
+      return NanThrowError(err.c_str());
+  } else if (!obj->sshbind) {
+    return NanThrowError("ssh_init failed");
+  } else {
+    obj->running = true;
+  }
+
   NanReturnValue(args.This());
 }
 
@@ -190,9 +377,129 @@ NAN_METHOD(Server::Close) {
 
   Server *s = ObjectWrap::Unwrap<Server>(args.This());
   s->Close();
+  NanDisposePersistent(s->onConnection);
   NanDisposePersistent(s->persistentHandle);
 
   NanReturnUndefined();
 }
 
+NAN_METHOD(Server::Stats) {
+  NanScope();
+
+  Server *s = ObjectWrap::Unwrap<Server>(args.This());
+  v8::Local<v8::Object> stats = NanNew<v8::Object>();
+  stats->Set(NanNew<v8::String>("accepted"),
+      NanNew<v8::Number>(s->acceptedCount));
+  stats->Set(NanNew<v8::String>("acceptFailed"),
+      NanNew<v8::Number>(s->acceptFailedCount));
+  stats->Set(NanNew<v8::String>("handshaking"),
+      NanNew<v8::Number>(s->handshakesActive));
+  stats->Set(NanNew<v8::String>("handshakesQueued"),
+      NanNew<v8::Number>(s->handshakeQueue.size()));
+  stats->Set(NanNew<v8::String>("handshakesRejected"),
+      NanNew<v8::Number>(s->handshakesRejectedCount));
+  if (s->kexKeyPool) {
+    uint32_t hits, misses;
+    s->kexKeyPool->Stats(hits, misses);
+    stats->Set(NanNew<v8::String>("kexKeyPoolHits"), NanNew<v8::Number>(hits));
+    stats->Set(NanNew<v8::String>("kexKeyPoolMisses"),
+        NanNew<v8::Number>(misses));
+  }
+
+  NanReturnValue(stats);
+}
+
+// sessions borrow the bind's host keys, connected sessions keep the keys
+// they were accepted with and new sessions pick up the reloaded ones
+NAN_METHOD(Server::ReloadHostKeys) {
+  NanScope();
+
+  Server *s = ObjectWrap::Unwrap<Server>(args.This());
+  if (!s->running)
+    return NanThrowError("server is not running");
+
+  std::string rsaHostKey = s->rsaHostKeyFile;
+  std::string dsaHostKey = s->dsaHostKeyFile;
+  if (args[0]->IsString())
+    rsaHostKey.assign(*v8::String::Utf8Value(args[0]));
+  if (args[1]->IsString())
+    dsaHostKey.assign(*v8::String::Utf8Value(args[1]));
+
+  ssh_bind_options_set(s->sshbind, SSH_BIND_OPTIONS_RSAKEY, rsaHostKey.c_str());
+  ssh_bind_options_set(s->sshbind, SSH_BIND_OPTIONS_DSAKEY, dsaHostKey.c_str());
+
+  if (ssh_bind_reload_keys(s->sshbind) != SSH_OK) {
+    std::string err("Error reloading host keys: ");
+    err.append(ssh_get_error(s->sshbind));
+    // the old keys are still loaded, the bind goes back to naming them
+    ssh_bind_options_set(
+        s->sshbind, SSH_BIND_OPTIONS_RSAKEY, s->rsaHostKeyFile.c_str());
+    ssh_bind_options_set(
+        s->sshbind, SSH_BIND_OPTIONS_DSAKEY, s->dsaHostKeyFile.c_str());
+    return NanThrowError(err.c_str());
+  }
+  s->rsaHostKeyFile = rsaHostKey;
+  s->dsaHostKeyFile = dsaHostKey;
+
+  if (NSSH_DEBUG)
+    std::cout << "Server::ReloadHostKeys done\n";
+
+  NanReturnUndefined();
+}
+
+// take an already-connected socket from somewhere else (a net.Server, a
+// socket-activation fd, a parent process...) and run an ssh session on it,
+// the server owns the fd from here on
+NAN_METHOD(Server::HandleSocket) {
+  NanScope();
+
+  Server *s = ObjectWrap::Unwrap<Server>(args.This());
+  if (!s->running)
+    return NanThrowError("server is not running");
+
+  if (!args[0]->IsNumber())
+    return NanThrowError("handleSocket() requires a file descriptor");
+
+  socket_t fd = args[0]->Int32Value();
+  if (args[1]->BooleanValue()) {
+    // the caller's handle will be closed, keep our own copy
+#ifdef _WIN32
+    return NanThrowError("handleSocket() can't share a socket on Windows");
+#else
+    fd = dup(fd);
+    if (fd < 0)
+      return NanThrowError("handleSocket() could not dup() the socket");
+#endif
+  }
+
+  ssh_session session = ssh_new();
+  if (ssh_bind_accept_fd(s->sshbind, session, fd) != SSH_OK) {
+    std::string err("Error accepting socket: ");
+    err.append(ssh_get_error(s->sshbind));
+    ssh_free(session);
+    s->acceptFailedCount++;
+    return NanThrowError(err.c_str());
+  }
+
+  if (NSSH_DEBUG)
+    std::cout << "Server::HandleSocket fd=" << fd << std::endl;
+
+  s->acceptedCount++;
+  s->StartSession(session);
+
+  NanReturnUndefined();
+}
+
+NAN_METHOD(Server::SetCallbacks) {
+  NanScope();
+
+  if (!args[0]->IsObject())
+    return NanThrowError("setCallbacks() requires an object");
+
+  Server *s = ObjectWrap::Unwrap<Server>(args.This());
+  SetCallback(s->onConnection, args[0].As<v8::Object>(), onConnection_symbol);
+
+  NanReturnUndefined();
+}
+
 } // namespace nssh
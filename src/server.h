@@ -8,9 +8,16 @@
 #include <node.h>
 #include <node_buffer.h>
 #include <libssh/server.h>
+#include <string>
+#include <deque>
 #include <nan.h>
 
 #include "nssh.h"
+#include "session.h"
+#include "kex_pool.h"
+
+// default max connections accepted per readable event on the listen socket
+#define NSSH_ACCEPT_BUDGET 32
 
 namespace nssh {
 
@@ -22,22 +29,51 @@ class Server : public node::ObjectWrap {
   Server (char *port, char *addr, char *rsaHostKey, char *dsaHostKey, char *banner);
   ~Server ();
 
+  bool Listen (std::string &error);
+  void StartSession (ssh_session session);
   void OnConnection (v8::Handle<v8::Object> session);
   void Close ();
 
  private:
   static void SocketPollCallback (uv_poll_t* handle, int status, int events);
+  static void HandshakeDoneCallback (Session *session, void *userData);
+
+  bool HandshakeSlotFree ();
+  void StartHandshakes ();
 
   ssh_bind sshbind;
   uv_poll_t *poll_handle;
   ssh_bind_callbacks_struct *bindCallbacks;
   v8::Persistent<v8::Object> persistentHandle;
   bool running;
+  bool offloadKex;
+  bool reusePort;
+  int acceptBudget;
+  int maxConcurrentHandshakes;
+  int maxPendingHandshakes;
+  int handshakesActive;
+  uint32_t handshakeTimeout;
+  std::deque<Session*> handshakeQueue;
+  KexKeyPool *kexKeyPool;
+  ssh_session nextSession;
+  uint32_t acceptedCount;
+  uint32_t acceptFailedCount;
+  uint32_t handshakesRejectedCount;
   char* port;
   char* addr;
+  // what the bind's keys were imported from, put back if a reload fails
+  std::string rsaHostKeyFile;
+  std::string dsaHostKeyFile;
 
   static NAN_METHOD(New);
   static NAN_METHOD(Close);
+  static NAN_METHOD(Stats);
+  static NAN_METHOD(ReloadHostKeys);
+  static NAN_METHOD(HandleSocket);
+  static NAN_METHOD(SetCallbacks);
+
+  // set from JS by setCallbacks(), let go of on close
+  v8::Persistent<v8::Function> onConnection;
 };
 
 } // namespace nssh
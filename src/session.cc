@@ -11,10 +11,15 @@
 #include <string.h>
 #include "session.h"
 #include "message.h"
+#include "tcp_relay.h"
+#include "tcp_forward.h"
 
 namespace nssh {
 
 static v8::Persistent<v8::FunctionTemplate> session_constructor;
+static v8::Persistent<v8::String> onMessage_symbol;
+static v8::Persistent<v8::String> onNewChannel_symbol;
+static v8::Persistent<v8::String> onHandshake_symbol;
 
 void Session::OnError (std::string err) {
   //TODO:
@@ -25,13 +30,10 @@ void Session::OnError (std::string err) {
 void Session::OnMessage (v8::Handle<v8::Object> message) {
   NanScope();
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onMessage"));
-
-  if (callback->IsFunction()) {
+  if (!onMessage.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = { message };
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onMessage)->Call(NanObjectWrapHandle(this), 1, argv);
 
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
@@ -41,13 +43,22 @@ void Session::OnMessage (v8::Handle<v8::Object> message) {
 void Session::OnNewChannel (v8::Handle<v8::Object> channel) {
   NanScope();
 
-  v8::Local<v8::Value> callback = NanObjectWrapHandle(this)
-      ->Get(NanNew<v8::String>("onNewChannel"));
-
-  if (callback->IsFunction()) {
+  if (!onNewChannel.IsEmpty()) {
     v8::TryCatch try_catch;
     v8::Handle<v8::Value> argv[] = { channel };
-    callback.As<v8::Function>()->Call(NanObjectWrapHandle(this), 1, argv);
+    NanNew(onNewChannel)->Call(NanObjectWrapHandle(this), 1, argv);
+
+    if (try_catch.HasCaught())
+      node::FatalException(try_catch);
+  }
+}
+
+void Session::OnHandshake () {
+  NanScope();
+
+  if (!onHandshake.IsEmpty()) {
+    v8::TryCatch try_catch;
+    NanNew(onHandshake)->Call(NanObjectWrapHandle(this), 0, NULL);
 
     if (try_catch.HasCaught())
       node::FatalException(try_catch);
@@ -60,21 +71,10 @@ void Session::ChannelClosedCallback (Channel *channel, void *userData) {
   if (NSSH_DEBUG)
     std::cout << "ChannelClosedCallback!\n";
 
-  std::vector<Channel*>::iterator it = s->channels.begin();
-  while (it != s->channels.end()) {
-    if ((*it)->IsChannel(channel->channel)) {
-      if (NSSH_DEBUG)
-        std::cout << "Removed " << (*it)->myid << std::endl;
-      s->channels.erase(it);
-      if (NSSH_DEBUG)
-        std::cout << "Found and removed channel from list\n";
-      break;
-    }
-    ++it;
-  }
+  s->RemoveChannel(channel);
 
   /*
-  if (s->channels.size() == 0) {
+  if (s->channelMap.size() == 0) {
     if (NSSH_DEBUG)
       std::cout << "!!!!!!!!!!!!!!!!!!!! CLOSING, NO MORE CHANNELS !!!!!!!!!!!!!!!!\n";
     s->Close();
@@ -82,6 +82,208 @@ void Session::ChannelClosedCallback (Channel *channel, void *userData) {
   */
 }
 
+void Session::ChannelResumedCallback (Channel *channel, void *userData) {
+  Session* s = static_cast<Session*>(userData);
+  s->Wake();
+}
+
+// get a read and write pass soon even if the socket has nothing new for us
+void Session::Wake () {
+  if (active && idle_handle)
+    uv_idle_start(idle_handle, ReadIdleCallback);
+}
+
+bool Session::IsClosed () {
+  return closed;
+}
+
+// accept a channel open request, the new Channel is ours to poll but
+// nobody has been told about it yet
+Channel *Session::AcceptChannel (ssh_message message) {
+  ssh_channel channel = ssh_message_channel_request_open_reply_accept(message);
+  if (!channel)
+    return NULL;
+  return WrapChannel(channel);
+}
+
+// an open libssh channel, either end may have opened it
+Channel *Session::WrapChannel (ssh_channel channel) {
+  Channel *c = node::ObjectWrap::Unwrap<Channel>(Channel::NewInstance(
+      session
+    , channel
+    , ChannelClosedCallback
+    , ChannelResumedCallback
+    , this
+  ));
+  AddChannel(c);
+  if (NSSH_DEBUG)
+    std::cout << "New channel " << c->myid << std::endl;
+  return c;
+}
+
+void Session::AddOpening (TcpRelay *relay) {
+  opening.push_back(relay);
+}
+
+// see if the client has answered any of our forwarded-tcpip opens, the
+// answers come in with everything else so this follows a read
+void Session::PollOpens () {
+  if (opening.empty())
+    return;
+
+  // the message loop has just read the client's answers, this only checks
+  // each channel's state
+  std::vector<TcpRelay*> polling;
+  polling.swap(opening);
+  for (size_t i = 0; i < polling.size(); i++) {
+    if (closed)
+      polling[i]->Cancel();
+    else if (polling[i]->PollOpen())
+      opening.push_back(polling[i]);
+  }
+}
+
+void Session::AddForward (TcpForward *forward) {
+  forward->nextForward = forwards;
+  forwards = forward;
+}
+
+bool Session::CancelForward (const char *address, int port) {
+  for (TcpForward **f = &forwards; *f; f = &(*f)->nextForward) {
+    if ((*f)->Matches(address, port)) {
+      TcpForward *forward = *f;
+      *f = forward->nextForward;
+      forward->Close();
+      return true;
+    }
+  }
+  return false;
+}
+
+// tcpip-forward and cancel-tcpip-forward, libssh doesn't queue these like
+// other messages, it frees them when we return so JS has to decide now
+void Session::GlobalRequestCallback (
+      ssh_session session
+    , ssh_message message
+    , void *userData
+  ) {
+
+  NanScope();
+
+  Session* s = static_cast<Session*>(userData);
+
+  if (NSSH_DEBUG)
+    std::cout << "GlobalRequestCallback " << ssh_message_subtype(message) << std::endl;
+
+  if (s->closed) {
+    ssh_message_reply_default(message);
+    return;
+  }
+
+  if (ssh_message_subtype(message) == SSH_GLOBAL_REQUEST_CANCEL_TCPIP_FORWARD) {
+    if (s->CancelForward(
+          ssh_message_global_request_address(message)
+        , ssh_message_global_request_port(message))) {
+      ssh_message_global_request_reply_success(message, 0);
+    } else {
+      ssh_message_reply_default(message);
+    }
+    return;
+  }
+
+  // libssh frees this one once we return
+  v8::Handle<v8::Object> mess =
+      Message::NewInstance(s->session, NULL, message, s, false);
+  s->OnMessage(mess);
+  Message::Expire(mess);
+}
+
+void Session::AddChannel (Channel *channel) {
+  channelMap[channel->channel] = channel;
+  channel->prevChannel = NULL;
+  channel->nextChannel = channels;
+  if (channels)
+    channels->prevChannel = channel;
+  channels = channel;
+}
+
+void Session::RemoveChannel (Channel *channel) {
+  std::unordered_map<ssh_channel, Channel*>::iterator it =
+      channelMap.find(channel->channel);
+  if (it == channelMap.end() || it->second != channel)
+    return;
+
+  channelMap.erase(it);
+  if (readChannel == channel)
+    readChannel = channel->nextChannel;
+  if (channel->prevChannel)
+    channel->prevChannel->nextChannel = channel->nextChannel;
+  else
+    channels = channel->nextChannel;
+  if (channel->nextChannel)
+    channel->nextChannel->prevChannel = channel->prevChannel;
+  channel->prevChannel = NULL;
+  channel->nextChannel = NULL;
+
+  if (NSSH_DEBUG)
+    std::cout << "Removed " << channel->myid << ", " << channelMap.size()
+      << " channels left\n";
+}
+
+// one pass over every channel, starting one further round each time so no
+// channel always goes first, returns true if any channel stopped short.
+// Queued writes go out first in case the window has opened since.
+bool Session::ReadChannels () {
+  size_t count = channelMap.size();
+  bool exhausted = false;
+
+  if (NSSH_DEBUG)
+    std::cout << "ReadChannels, " << count << " channels\n";
+
+  Channel *channel = readChannel ? readChannel : channels;
+  readChannel = channel ? channel->nextChannel : NULL;
+
+  while (channel && count-- > 0) {
+    // TryRead() may close the channel and take it off the list
+    Channel *next = channel->nextChannel ? channel->nextChannel : channels;
+    if (channel->HasQueuedWrites())
+      channel->FlushWrites();
+    channel->TryRead(&exhausted);
+    channel = next;
+  }
+
+  return exhausted;
+}
+
+NSSH_IDLE_CALLBACK(Session::ReadIdleCallback) {
+  Session* s = static_cast<Session*>(handle->data);
+
+  uv_idle_stop(handle);
+  if (s->active && !s->handshaking)
+    SocketPollCallback(s->poll_handle, 0, UV_READABLE);
+}
+
+void Session::IdleClosedCallback (uv_handle_t *handle) {
+  delete reinterpret_cast<uv_idle_t*>(handle);
+}
+
+// the client has had long enough, it's either stalled or was never going
+// to finish, e.g. a port scanner sitting on the connection
+NSSH_TIMER_CALLBACK(Session::HandshakeTimeoutCallback) {
+  Session* s = static_cast<Session*>(handle->data);
+
+  if (NSSH_DEBUG)
+    std::cout << "HandshakeTimeoutCallback\n";
+
+  s->OnError("Handshake timed out");
+  s->timedOut = true;
+  s->Close();
+}
+
+void Session::TimerClosedCallback (uv_handle_t *handle) {
+  delete reinterpret_cast<uv_timer_t*>(handle);
+}
+
 void Session::SocketPollCallback (uv_poll_t* handle, int status, int events) {
   NanScope();
 
@@ -98,6 +300,24 @@ void Session::SocketPollCallback (uv_poll_t* handle, int status, int events) {
   if (!s->active)
     return;
 
+  if (events & UV_WRITABLE) {
+    if (ssh_nonblocking_flush(s->session) == SSH_ERROR) {
+      if (NSSH_DEBUG)
+        std::cout << "ssh_nonblocking_flush() failed, closing\n";
+      return s->Close();
+    }
+  }
+
+  if (s->handshaking) {
+    s->KeyExchange();
+    // still waiting on the client, or the kex failed and we're closed
+    if (s->handshaking || !s->active) {
+      if (s->active)
+        s->UpdatePollEvents();
+      return;
+    }
+  }
+
   ssh_message message;
   int type;
   int subtype;
@@ -133,92 +353,151 @@ void Session::SocketPollCallback (uv_poll_t* handle, int status, int events) {
       if (NSSH_DEBUG)
         std::cout << "New Channel\n";
 
-      v8::Handle<v8::Object> channel = Channel::NewInstance(
-          s->session
-        , ssh_message_channel_request_open_reply_accept(message)
-        , s->ChannelClosedCallback
-        , s
-      );
-
-      s->channels.push_back(node::ObjectWrap::Unwrap<Channel>(channel));
-      if (NSSH_DEBUG)
-        std::cout << "New channel " << node::ObjectWrap::Unwrap<Channel>(channel)->myid << std::endl;
-      s->OnNewChannel(channel);
+      Channel *channel = s->AcceptChannel(message);
+      if (channel)
+        s->OnNewChannel(NanObjectWrapHandle(channel));
 
       ssh_message_free(message);
     } else {
       if (type == SSH_REQUEST_CHANNEL && subtype) {
-        if (NSSH_DEBUG)
-          std::cout << "*****************************" << s->channels.size() << " channels\n";
-        std::vector<Channel*>::reverse_iterator it = s->channels.rbegin();
-        while (it != s->channels.rend()) {
+        std::unordered_map<ssh_channel, Channel*>::iterator it =
+            s->channelMap.find(ssh_message_channel_request_channel(message));
+        if (it != s->channelMap.end()) {
           if (NSSH_DEBUG)
-            std::cout << "*************** IT1 NEXT ************** " << (*it)->myid << std::endl;
-          if ((*it)->IsChannel(ssh_message_channel_request_channel(message))) {
-            (*it)->OnMessage(Message::NewInstance(s->session, *it, message));
-            break;
-          }
-          ++it;
+            std::cout << "Channel request for " << it->second->myid << std::endl;
+          v8::Handle<v8::Object> mess =
+              Message::NewInstance(s->session, it->second, message);
+          it->second->OnMessage(mess);
+          Message::Release(mess); // freed on ~Message()
+        } else {
+          ssh_message_free(message);
         }
-        if (NSSH_DEBUG)
-          std::cout << "*****************************\n";
-        ssh_message_free(message);
       } else {
         v8::Handle<v8::Object> mess =
-            Message::NewInstance(s->session, NULL, message);
+            Message::NewInstance(s->session, NULL, message, s);
         s->OnMessage(mess);
         // freed on ~Message()
       }
     }
   }
 
-  bool channelData = false;
-  if (NSSH_DEBUG)
-    std::cout << "***************************** " << s->channels.size() << " channels\n";
-  std::vector<Channel*>::reverse_iterator it = s->channels.rbegin();
-  while (it != s->channels.rend()) {
-    if (NSSH_DEBUG)
-      std::cout << "*************** IT2 NEXT ************** " << (*it)->myid << std::endl;
-    if ((*it)->TryRead()) {
-      channelData = true;
-      break;
-    }
-    ++it;
-  }
-  if (NSSH_DEBUG)
-    std::cout << "*****************************\n";
+  s->PollOpens();
 
-  if (NSSH_DEBUG)
-    std::cout << "Channel Data: " << (channelData ? "yes" : "no") << std::endl;
+  if (s->ReadChannels()) {
+    // someone ran out of budget, come back for the rest once libuv has
+    // had a chance to service everything else
+    uv_idle_start(s->idle_handle, ReadIdleCallback);
+  }
 
   if (ssh_get_status(s->session) & SSH_CLOSED_ERROR) {
     if (NSSH_DEBUG)
       std::cout << "session status is SSH_CLOSED_ERROR, closing2\n";
     return s->Close();
   }
+
+  s->UpdatePollEvents();
+}
+
+// libssh only writes when it thinks the socket will take it, so while it has
+// output buffered we need to know when that is rather than waiting on the
+// client to send us something
+void Session::UpdatePollEvents () {
+  if (!poll_handle || kexWork)
+    return;
+
+  int events = UV_READABLE;
+  if (ssh_get_poll_flags(session) & SSH_WRITE_PENDING)
+    events |= UV_WRITABLE;
+
+  if (events != pollEvents) {
+    if (NSSH_DEBUG)
+      std::cout << "UpdatePollEvents " << events << std::endl;
+    pollEvents = events;
+    uv_poll_start(poll_handle, events, SocketPollCallback);
+  }
 }
 
 Session::Session () {
   active = false;
+  closed = false;
+  queued = false;
+  handshaking = false;
+  kexPending = false;
+  timedOut = false;
+  kexWork = NULL;
+  poll_handle = NULL;
+  idle_handle = NULL;
+  handshake_timer = NULL;
+  pollEvents = 0;
+  channels = NULL;
+  readChannel = NULL;
+  forwards = NULL;
+  memset(&callbacks, 0, sizeof(callbacks));
+  handshakeDoneCallback = NULL;
+  callbackUserData = NULL;
 }
 
 Session::~Session () {
   Close();
   ssh_free(session);
-  //delete callbacks;
 }
 
 void Session::Close () {
   active = false;
-  uv_poll_stop(poll_handle);
-  delete poll_handle;
-  ssh_set_callbacks(session, 0);
+  closed = true;
+  kexPending = false;
+  // KexWorkAfter() finishes the job once the threadpool is done with us
+  if (kexWork)
+    return;
+  HandshakeDone();
+  if (poll_handle) {
+    uv_poll_stop(poll_handle);
+    delete poll_handle;
+    poll_handle = NULL;
+  }
+  if (idle_handle) {
+    uv_idle_stop(idle_handle);
+    uv_close(reinterpret_cast<uv_handle_t*>(idle_handle), IdleClosedCallback);
+    idle_handle = NULL;
+  }
+  // libssh won't take a NULL, but it checks for each function
+  callbacks.global_request_function = NULL;
   ssh_set_message_callback(session, 0, 0);
+  // exec'd children, forwarded connections, native SFTP requests and JS
+  // all have to let go of the channels now
+  while (channels) {
+    Channel *c = channels;
+    RemoveChannel(c);
+    c->SessionClosed();
+  }
+  for (size_t i = 0; i < opening.size(); i++)
+    opening[i]->Cancel();
+  opening.clear();
+  while (forwards) {
+    TcpForward *f = forwards;
+    forwards = f->nextForward;
+    f->Close();
+  }
   //TODO: investigate whether this is needed in some way, it doesn't
   // work when you have data in the pipe when called:
   //ssh_disconnect(session);
+  if (timedOut) {
+    // JS never got a handshake out of this one so won't close it, hang up
+    // and let go of it ourselves
+    ssh_silent_disconnect(session);
+    NanDisposePersistent(persistentHandle);
+  }
   if (NSSH_DEBUG)
-    std::cout << "Stopped polling session, " << channels.size() << " channels open\n";
+    std::cout << "Stopped polling session, " << channelMap.size() << " channels open\n";
+  DisposeCallbacks();
+}
+
+// they close over the JS object wrapping us, holding them past close
+// would keep us both alive
+void Session::DisposeCallbacks () {
+  NanDisposePersistent(onMessage);
+  NanDisposePersistent(onNewChannel);
+  NanDisposePersistent(onHandshake);
 }
 
 void Session::SetAuthMethods (int methods) {
@@ -244,14 +523,6 @@ void SessionLogCallback (ssh_session session, int priority,
       << std::endl;
 }
 
-// not sure if this gets used
-void SessionGlobalRequestCallback (ssh_session session, ssh_message message,
-    void *userdata) {
-
-  if (NSSH_DEBUG)
-    std::cout << "SessionGlobalRequestCallback!\n";
-}
-
 // not used as far as I can tell
 int Session::SessionMessageCallback (ssh_session session, ssh_message message, void *data) {
   if (NSSH_DEBUG)
@@ -266,39 +537,196 @@ void SessionStatusCallback (void *userdata, float status) {
 }
 
 
-void Session::Start () {
+// waiting on the server for a handshake slot, we're not polled in the
+// meantime so hold a ref in case JS lets go of us
+void Session::Queue () {
+  queued = true;
+  Ref();
+}
+
+// the server is closing with us still waiting for a handshake slot, the
+// client gets the banner and is disconnected like any other rejection
+void Session::Reject () {
+  if (queued) {
+    queued = false;
+    Unref();
+  }
+  if (!closed)
+    ssh_server_reject(session);
+  Close();
+  NanDisposePersistent(persistentHandle);
+}
+
+// returns false if we were closed while waiting in the queue, a
+// `handshakeTimeout` of 0 lets the kex take as long as it likes
+bool Session::Start (
+      bool offloadKex
+    , KexKeyPool *kexKeyPool
+    , uint32_t handshakeTimeout
+  ) {
+
+  if (queued) {
+    queued = false;
+    Unref();
+  }
+  if (closed)
+    return false;
+
   /*
-  callbacks = new ssh_callbacks_struct;
-  callbacks->auth_function = SessionAuthCallback;
-  callbacks->log_function = SessionLogCallback;
-  callbacks->global_request_function = SessionGlobalRequestCallback;
-  callbacks->connect_status_function = SessionStatusCallback;
-  callbacks->userdata = this;
-  ssh_callbacks_init(callbacks);
-  ssh_set_callbacks(session, callbacks);
   ssh_set_message_callback(session, SessionMessageCallback, this);
   */
 
+  callbacks.userdata = this;
+  callbacks.global_request_function = GlobalRequestCallback;
+  ssh_callbacks_init(&callbacks);
+  ssh_set_callbacks(session, &callbacks);
+
   ssh_options_set(session, SSH_OPTIONS_TIMEOUT, "0");
   ssh_options_set(session, SSH_OPTIONS_TIMEOUT_USEC, "1");
   ssh_set_blocking(session, 0);
 
-  //TODO: do this async
-  if (ssh_handle_key_exchange(session)) {
-    std::string err("Key exchange error: ");
-    err.append(ssh_get_error(session));
-    OnError(err);
-  }
+  if (offloadKex)
+    ssh_set_kex_offload_callback(session, KexOffloadCallback, this);
+  if (kexKeyPool)
+    ssh_set_kex_keypair_callback(session, KexKeyPool::TakeCallback, kexKeyPool);
 
   active = true;
+  handshaking = true;
   poll_handle = new uv_poll_t;
   uv_os_sock_t socket = ssh_get_fd(session);
   poll_handle->data = this;
   uv_poll_init_socket(uv_default_loop(), poll_handle, socket);
-  uv_poll_start(poll_handle, UV_READABLE, SocketPollCallback);
+  pollEvents = 0;
+  UpdatePollEvents();
+  idle_handle = new uv_idle_t;
+  idle_handle->data = this;
+  uv_idle_init(uv_default_loop(), idle_handle);
+  if (handshakeTimeout > 0) {
+    handshake_timer = new uv_timer_t;
+    handshake_timer->data = this;
+    uv_timer_init(uv_default_loop(), handshake_timer);
+    uv_timer_start(
+        handshake_timer
+      , HandshakeTimeoutCallback
+      , handshakeTimeout
+      , 0
+    );
+  }
 
   if (NSSH_DEBUG)
     std::cout << "polling started\n";
+
+  // sends our banner and KEXINIT, the rest of the kex is driven from
+  // SocketPollCallback as the client's packets arrive
+  KeyExchange();
+  // whatever the socket wouldn't take yet needs a writable poll, the
+  // client may be waiting on it before it sends anything
+  UpdatePollEvents();
+  return true;
+}
+
+// in non-blocking mode ssh_handle_key_exchange() returns SSH_AGAIN until
+// the client has sent everything we need, it's safe to re-enter it each
+// time the socket becomes readable
+void Session::KeyExchange () {
+  int rc = ssh_handle_key_exchange(session);
+
+  if (NSSH_DEBUG)
+    std::cout << "ssh_handle_key_exchange() = " << rc << std::endl;
+
+  if (rc == SSH_AGAIN) {
+    if (kexPending)
+      QueueKexWork();
+    return;
+  }
+
+  if (rc != SSH_OK) {
+    std::string err("Key exchange error: ");
+    err.append(ssh_get_error(session));
+    OnError(err);
+    return Close();
+  }
+
+  // rekeying happens alongside channel traffic, only the initial kex
+  // gets to leave the loop thread
+  ssh_set_kex_offload_callback(session, NULL, NULL);
+  ssh_set_kex_keypair_callback(session, NULL, NULL);
+  HandshakeDone();
+  OnHandshake();
+}
+
+// the kex is over one way or another, let the server hand our slot on
+void Session::HandshakeDone () {
+  if (!handshaking)
+    return;
+  handshaking = false;
+  if (handshake_timer) {
+    uv_timer_stop(handshake_timer);
+    uv_close(
+        reinterpret_cast<uv_handle_t*>(handshake_timer)
+      , TimerClosedCallback
+    );
+    handshake_timer = NULL;
+  }
+  if (handshakeDoneCallback)
+    handshakeDoneCallback(this, callbackUserData);
+}
+
+// libssh calls this from within ssh_handle_key_exchange() once it has
+// imported the client's KEXDH_INIT, we can't hand the session to another
+// thread until that call has unwound so just make a note of it
+void Session::KexOffloadCallback (ssh_session session, void *userData) {
+  Session* s = static_cast<Session*>(userData);
+
+  if (NSSH_DEBUG)
+    std::cout << "KexOffloadCallback\n";
+
+  s->kexPending = true;
+}
+
+void Session::QueueKexWork () {
+  kexPending = false;
+  // nothing may touch the session while it's on the threadpool
+  uv_poll_stop(poll_handle);
+  pollEvents = 0;
+  Ref();
+  kexWork = new uv_work_t;
+  kexWork->data = this;
+  uv_queue_work(uv_default_loop(), kexWork, KexWork, KexWorkAfter);
+}
+
+// shared secret and exchange hash signature, off the loop thread
+void Session::KexWork (uv_work_t *req) {
+  Session* s = static_cast<Session*>(req->data);
+  ssh_server_kex_compute(s->session);
+}
+
+void Session::KexWorkAfter (uv_work_t *req, int status) {
+  NanScope();
+
+  Session* s = static_cast<Session*>(req->data);
+  delete req;
+  s->kexWork = NULL;
+
+  if (NSSH_DEBUG)
+    std::cout << "KexWorkAfter active=" << s->active << std::endl;
+
+  if (!s->active) {
+    // closed while we were on the threadpool
+    s->Close();
+  } else if (ssh_server_kex_reply(s->session) != SSH_OK) {
+    std::string err("Key exchange error: ");
+    err.append(ssh_get_error(s->session));
+    s->OnError(err);
+    s->Close();
+  } else {
+    s->UpdatePollEvents();
+    s->KeyExchange();
+    // the reply and our NEWKEYS may still be buffered
+    s->UpdatePollEvents();
+  }
+
+  s->Unref();
 }
 
 void Session::Init () {
@@ -309,9 +737,19 @@ void Session::Init () {
   tpl->SetClassName(NanNew<v8::String>("Session"));
   tpl->InstanceTemplate()->SetInternalFieldCount(1);
   NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "setCallbacks", SetCallbacks);
+
+  NanAssignPersistent(onMessage_symbol, NanNew<v8::String>("onMessage"));
+  NanAssignPersistent(onNewChannel_symbol, NanNew<v8::String>("onNewChannel"));
+  NanAssignPersistent(onHandshake_symbol, NanNew<v8::String>("onHandshake"));
 }
 
-v8::Handle<v8::Object> Session::NewInstance (ssh_session session) {
+v8::Handle<v8::Object> Session::NewInstance (
+      ssh_session session
+    , HandshakeDoneCallback handshakeDoneCallback
+    , void *callbackUserData
+  ) {
+
   NanEscapableScope();
 
   v8::Local<v8::Object> instance;
@@ -319,6 +757,8 @@ v8::Handle<v8::Object> Session::NewInstance (ssh_session session) {
   instance = constructorHandle->GetFunction()->NewInstance(0, NULL);
   Session *s = ObjectWrap::Unwrap<Session>(instance);
   s->session = session;
+  s->handshakeDoneCallback = handshakeDoneCallback;
+  s->callbackUserData = callbackUserData;
   NanAssignPersistent(s->persistentHandle, instance);
 
   if (NSSH_DEBUG)
@@ -359,4 +799,19 @@ NAN_METHOD(Session::SetAuthMethods) {
   NanReturnUndefined();
 }
 
+NAN_METHOD(Session::SetCallbacks) {
+  NanScope();
+
+  if (!args[0]->IsObject())
+    return NanThrowError("setCallbacks() requires an object");
+
+  Session *s = ObjectWrap::Unwrap<Session>(args.This());
+  v8::Local<v8::Object> callbacks = args[0].As<v8::Object>();
+  SetCallback(s->onMessage, callbacks, onMessage_symbol);
+  SetCallback(s->onNewChannel, callbacks, onNewChannel_symbol);
+  SetCallback(s->onHandshake, callbacks, onHandshake_symbol);
+
+  NanReturnUndefined();
+}
+
 } // namespace nssh
@@ -9,46 +9,123 @@
 #include <node_buffer.h>
 #include <libssh/server.h>
 #include <libssh/poll.h>
+#include <libssh/callbacks.h>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <nan.h>
 
 #include "nssh.h"
 #include "channel.h"
+#include "kex_pool.h"
 
 namespace nssh {
 
+class TcpRelay;
+class TcpForward;
+
 class Session : public node::ObjectWrap {
  public:
+  typedef void (*HandshakeDoneCallback) (Session *session, void *userData);
+
   static void Init ();
-  static v8::Handle<v8::Object> NewInstance (ssh_session session);
+  static v8::Handle<v8::Object> NewInstance (
+      ssh_session session
+    , HandshakeDoneCallback handshakeDoneCallback
+    , void *callbackUserData
+  );
 
   Session ();
   ~Session ();
 
-  void Start ();
+  void Queue ();
+  bool Start (
+      bool offloadKex
+    , KexKeyPool *kexKeyPool
+    , uint32_t handshakeTimeout
+  );
+  void Reject ();
   void Close ();
   void SetAuthMethods (int methods);
   void OnMessage (v8::Handle<v8::Object> message);
   void OnNewChannel (v8::Handle<v8::Object> channel);
+  void OnHandshake ();
   void OnError (std::string error);
+  bool IsClosed ();
+  void Wake ();
+  Channel *AcceptChannel (ssh_message message);
+  Channel *WrapChannel (ssh_channel channel);
+  void AddOpening (TcpRelay *relay);
+  void AddForward (TcpForward *forward);
 
  private:
+  void DisposeCallbacks ();
+
   static void SocketPollCallback (uv_poll_t* handle, int status, int events);
   static void ChannelClosedCallback (Channel *channel, void *user);
+  static void ChannelResumedCallback (Channel *channel, void *user);
   static int SessionMessageCallback (ssh_session session, ssh_message message, void *data);
+  static void GlobalRequestCallback (
+      ssh_session session
+    , ssh_message message
+    , void *userData
+  );
+  static void KexOffloadCallback (ssh_session session, void *userData);
+  static void KexWork (uv_work_t *req);
+  static void KexWorkAfter (uv_work_t *req, int status);
+  static NSSH_IDLE_CALLBACK(ReadIdleCallback);
+  static void IdleClosedCallback (uv_handle_t *handle);
+  static NSSH_TIMER_CALLBACK(HandshakeTimeoutCallback);
+  static void TimerClosedCallback (uv_handle_t *handle);
+
+  void KeyExchange ();
+  void QueueKexWork ();
+  void HandshakeDone ();
+  void AddChannel (Channel *channel);
+  void RemoveChannel (Channel *channel);
+  bool ReadChannels ();
+  void PollOpens ();
+  bool CancelForward (const char *address, int port);
+  void UpdatePollEvents ();
 
   ssh_session session;
   uv_poll_t *poll_handle;
-  ssh_callbacks_struct *callbacks;
+  uv_idle_t *idle_handle;
+  // running from Start() until the initial kex is over
+  uv_timer_t *handshake_timer;
+  int pollEvents;
+  struct ssh_callbacks_struct callbacks;
   v8::Persistent<v8::Object> persistentHandle;
   bool active;
+  bool closed;
+  bool queued;
+  bool handshaking;
+  bool kexPending;
+  bool timedOut;
+  uv_work_t *kexWork;
+  HandshakeDoneCallback handshakeDoneCallback;
+  void *callbackUserData;
 
-  std::vector<Channel*> channels;
+  // open channels by libssh channel for message dispatch, and linked
+  // newest first through the Channels themselves for walking them all
+  std::unordered_map<ssh_channel, Channel*> channelMap;
+  Channel *channels;
+  // where the next read pass starts
+  Channel *readChannel;
+  // forwarded-tcpip channels the client hasn't answered yet
+  std::vector<TcpRelay*> opening;
+  // tcpip-forward listeners
+  TcpForward *forwards;
 
   static NAN_METHOD(New);
   static NAN_METHOD(Close);
   static NAN_METHOD(SetAuthMethods);
+  static NAN_METHOD(SetCallbacks);
+
+  // set from JS by setCallbacks(), let go of on close
+  v8::Persistent<v8::Function> onMessage;
+  v8::Persistent<v8::Function> onNewChannel;
+  v8::Persistent<v8::Function> onHandshake;
 };
 
 } // namespace nssh
@@ -13,6 +13,49 @@
 namespace nssh {
 
 v8::Persistent<v8::FunctionTemplate> sftpmessage_constructor;
+static v8::Persistent<v8::Function> sftpmessage_function;
+static v8::Persistent<v8::String> typeSymbols[256];
+
+enum {
+    kTypeField
+  , kHandleField
+  , kFilenameField
+  , kOffsetField
+  , kLengthField
+  , kDataField
+  , kFlagsField
+  , kFieldCount
+};
+
+static const char *fieldNames[kFieldCount] = {
+    "type"
+  , "handle"
+  , "filename"
+  , "offset"
+  , "length"
+  , "data"
+  , "flags"
+};
+
+// whatever JS gave replyHandle() for the handle the client sent, TryRead()
+// has already turned away any that aren't open
+static v8::Local<v8::Value> HandleValue (
+      Channel *channel
+    , sftp_client_message message) {
+
+  v8::Persistent<v8::Value> **value = channel->SftpHandles()->Find(
+      static_cast<const char*>(ssh_string_data(message->handle))
+    , ssh_string_len(message->handle)
+  );
+  if (!value)
+    return NanUndefined();
+  return NanNew(**value);
+}
+
+// a WRITE's `data` Buffer has been collected
+static void FreeWriteData (char *data, void *hint) {
+  ssh_string_free(static_cast<ssh_string>(hint));
+}
 
 inline uint32_t StringToStatusCode (v8::Handle<v8::String> str) {
   NanScope();
@@ -86,7 +129,7 @@ inline uint32_t StringToStatusCode (v8::Handle<v8::String> str) {
   return SSH_FX_OK;
 }
 
-inline const char* SftpMessage::MessageTypeToString (int type) {
+const char* SftpMessage::MessageTypeToString (int type) {
   switch (type) {
     case SSH_FXP_INIT:
       return "init";
@@ -138,6 +181,8 @@ SftpMessage::SftpMessage () {
 
 SftpMessage::~SftpMessage () {
   sftp_client_message_free(message);
+  NanDisposePersistent(handleValue);
+  NanDisposePersistent(writeData);
 }
 
 void SftpMessage::Init () {
@@ -146,13 +191,29 @@ void SftpMessage::Init () {
   v8::Local<v8::FunctionTemplate> tpl = NanNew<v8::FunctionTemplate>(New);
   NanAssignPersistent(sftpmessage_constructor, tpl);
   tpl->SetClassName(NanNew<v8::String>("SftpMessage"));
-  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  v8::Local<v8::ObjectTemplate> instance = tpl->InstanceTemplate();
+  instance->SetInternalFieldCount(1);
+  for (int i = 0; i < kFieldCount; i++) {
+    instance->SetAccessor(
+        NanNew<v8::String>(fieldNames[i])
+      , GetField
+      , 0
+      , NanNew<v8::Integer>(i)
+    );
+  }
+
+  // made once, not per message
+  for (int type = 0; type < 256; type++)
+    NanAssignPersistent(typeSymbols[type], NanNew<v8::String>(MessageTypeToString(type)));
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyName", ReplyName);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyNames", ReplyNames);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyAttr", ReplyAttr);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyHandle", ReplyHandle);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyStatus", ReplyStatus);
   NODE_SET_PROTOTYPE_METHOD(tpl, "replyData", ReplyData);
+
+  NanAssignPersistent(sftpmessage_function, tpl->GetFunction());
 }
 
 v8::Handle<v8::Object> SftpMessage::NewInstance (
@@ -165,156 +226,87 @@ v8::Handle<v8::Object> SftpMessage::NewInstance (
   if (NSSH_DEBUG)
     std::cout << "SftpMessage::NewInstance\n";
 
-  v8::Local<v8::FunctionTemplate> constructorHandle = NanNew(sftpmessage_constructor);
   v8::Local<v8::Object> instance =
-      constructorHandle->GetFunction()->NewInstance(0, NULL);
+      NanNew(sftpmessage_function)->NewInstance(0, NULL);
 
   SftpMessage *m = ObjectWrap::Unwrap<SftpMessage>(instance);
   m->session = session;
   m->channel = channel;
   m->message = message;
+  // resolved now, the table may have let go of it by the time it's read
+  if (message->handle)
+    NanAssignPersistent(m->handleValue, HandleValue(channel, message));
 
   if (NSSH_DEBUG)
     std::cout << "SftpMessage::NewInstance got instance\n";
 
-  const char *typeStr = MessageTypeToString(message->type);
-  instance->Set(NanNew<v8::String>("type"), typeStr == NULL
-    ? NanNull()->ToObject()
-    : NanNew<v8::String>(typeStr)->ToObject()
-  );
+  return NanEscapeScope(instance);
+}
 
-  switch(message->type) {
-    case SSH_FXP_CLOSE:
-    case SSH_FXP_READDIR:
-      if (NSSH_DEBUG)
-        std::cout << "SSH_FXP_READDIR: "
-          << (const char *)message->handle->data << ":"
-          << ssh_string_len(message->handle) << std::endl;
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      break;
-    case SSH_FXP_READ:
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      instance->Set(NanNew<v8::String>("offset"), NanNew<v8::Number>(message->offset));
-      instance->Set(NanNew<v8::String>("length"), NanNew<v8::Integer>(message->len));
-      break;
-    case SSH_FXP_WRITE:
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      if (NSSH_DEBUG)
-        std::cout << "read `data`, " << ssh_string_len(message->data)
-          << " bytes\n";
-      instance->Set(NanNew<v8::String>("offset"), NanNew<v8::Number>(message->offset));
-      instance->Set(NanNew<v8::String>("data"), NanNewBufferHandle(
-          (char *)ssh_string_get_char(message->data)
-        , ssh_string_len(message->data)
-      ));
-      break;
-    case SSH_FXP_REMOVE:
-    case SSH_FXP_RMDIR:
-    case SSH_FXP_OPENDIR:
-    case SSH_FXP_READLINK:
-    case SSH_FXP_REALPATH:
-      instance->Set(NanNew<v8::String>("filename"), NanNew<v8::String>(
-          (const char *)message->filename));
-      break;
-    case SSH_FXP_RENAME:
-    case SSH_FXP_SYMLINK:
-      instance->Set(NanNew<v8::String>("filename"), NanNew<v8::String>(
-          (const char *)message->filename));
-      instance->Set(NanNew<v8::String>("data"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
+// the message's properties are read from the libssh message as they're
+// asked for, most handlers only look at one or two
+NAN_GETTER(SftpMessage::GetField) {
+  NanScope();
+
+  SftpMessage* m = node::ObjectWrap::Unwrap<SftpMessage>(args.This());
+  sftp_client_message message = m->message;
+  uint8_t type = message->type;
+
+  switch (args.Data()->Int32Value()) {
+    case kTypeField:
+      NanReturnValue(NanNew(typeSymbols[type]));
+
+    case kHandleField:
+      if (!m->handleValue.IsEmpty())
+        NanReturnValue(NanNew(m->handleValue));
       break;
-    case SSH_FXP_MKDIR:
-    case SSH_FXP_SETSTAT:
-      instance->Set(NanNew<v8::String>("filename"), NanNew<v8::String>(
-          (const char *)message->filename));
-      /*TODO: attr struct..
-      msg->attr = sftp_parse_attr(sftp, payload, 0);
-      if (msg->attr == NULL) {
-        ssh_set_error_oom(session);
-        sftp_client_message_free(msg);
-        return NULL;
-      }
-      */
+
+    case kFilenameField:
+      if (message->filename)
+        NanReturnValue(NanNew<v8::String>(message->filename));
       break;
-    case SSH_FXP_FSETSTAT:
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      /*TODO: attr struct..
-      msg->attr = sftp_parse_attr(sftp, payload, 0);
-      if (msg->attr == NULL) {
-        ssh_set_error_oom(session);
-        sftp_client_message_free(msg);
-        return NULL;
-      }
-      */
+
+    case kOffsetField:
+      if (type == SSH_FXP_READ || type == SSH_FXP_WRITE)
+        NanReturnValue(NanNew<v8::Number>(message->offset));
       break;
-    case SSH_FXP_LSTAT:
-    case SSH_FXP_STAT:
-      instance->Set(NanNew<v8::String>("filename"), NanNew<v8::String>(
-          (const char *)message->filename));
-      instance->Set(NanNew<v8::String>("flags"), NanNew<v8::Integer>(message->flags));
-      /* TODO: flags, array of strings? rwa?
-      if(sftp->version > 3) {
-        buffer_get_u32(payload,&msg->flags);
-      }
-      */
+
+    case kLengthField:
+      if (type == SSH_FXP_READ)
+        NanReturnValue(NanNew<v8::Integer>(message->len));
       break;
-    case SSH_FXP_OPEN:
-      instance->Set(NanNew<v8::String>("filename"), NanNew<v8::String>(
-          (const char *)message->filename));
-      if (NSSH_DEBUG)
-        std::cout << "SSH_FXP_OPEN flags = " << message->flags << std::endl;
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      instance->Set(NanNew<v8::String>("flags"), NanNew<v8::Integer>(message->flags));
-      //TODO: use node core style mode: http://nodejs.org/docs/latest/api/fs.html#fs_fs_open_path_flags_mode_callback
-      /* TODO: flags, array of strings? rwa?
-#define SSH_FXF_READ 0x01
-#define SSH_FXF_WRITE 0x02
-#define SSH_FXF_APPEND 0x04
-#define SSH_FXF_CREAT 0x08
-#define SSH_FXF_TRUNC 0x10
-#define SSH_FXF_EXCL 0x20
-#define SSH_FXF_TEXT 0x40
-      instance->Set(NanNew<v8::String>("flags"), NanNew<v8::String>(
-          (const char *)message->flags));
-
-      buffer_get_u32(payload,&msg->flags);
-      */
-      /*TODO: attr struct..
-      msg->attr = sftp_parse_attr(sftp, payload, 0);
-      if (msg->attr == NULL) {
-        ssh_set_error_oom(session);
-        sftp_client_message_free(msg);
-        return NULL;
+
+    case kDataField:
+      if (type == SSH_FXP_WRITE) {
+        if (m->writeData.IsEmpty() && message->data) {
+          // the Buffer takes libssh's copy of the data rather than copying it
+          ssh_string data = message->data;
+          message->data = NULL;
+          NanAssignPersistent(m->writeData, NanNewBufferHandle(
+              static_cast<char*>(ssh_string_data(data))
+            , ssh_string_len(data)
+            , FreeWriteData
+            , data
+          ));
+        }
+        if (!m->writeData.IsEmpty())
+          NanReturnValue(NanNew(m->writeData));
+      } else if (message->data) { // RENAME and SYMLINK
+        NanReturnValue(NanNew<v8::String>(
+            static_cast<const char*>(ssh_string_data(message->data))
+          , ssh_string_len(message->data)
+        ));
       }
-      */
       break;
-    case SSH_FXP_FSTAT:
-      instance->Set(NanNew<v8::String>("handle"), NanNew<v8::String>(
-          (const char *)message->handle->data
-        , ssh_string_len(message->handle))
-      );
-      instance->Set(NanNew<v8::String>("flags"), NanNew<v8::Integer>(message->flags));
+
+    case kFlagsField:
+      if (type == SSH_FXP_STAT || type == SSH_FXP_LSTAT
+          || type == SSH_FXP_OPEN || type == SSH_FXP_FSTAT)
+        NanReturnValue(NanNew<v8::Integer>(message->flags));
       break;
   }
 
-  return NanEscapeScope(instance);
+  NanReturnUndefined();
 }
 
 static inline bool HasStringProperty(
@@ -524,16 +516,32 @@ NAN_METHOD(SftpMessage::ReplyAttr) {
   NanReturnUndefined();
 }
 
+// the client gets a handle from our table, `handle` is kept and given back
+// as the `handle` of each message using it until the client closes it. A
+// failure status is sent and false returned if the client has too many.
 NAN_METHOD(SftpMessage::ReplyHandle) {
   NanScope();
 
-  v8::String::Utf8Value s(args[0]);
-
   //TODO: async
   SftpMessage* m = node::ObjectWrap::Unwrap<SftpMessage>(args.This());
-  sftp_reply_handle(m->message, ssh_string_from_char(*s)); // free x 2
+  HandleTable<v8::Persistent<v8::Value>*> *handles = m->channel->SftpHandles();
+
+  v8::Persistent<v8::Value> *value = new v8::Persistent<v8::Value>;
+  NanAssignPersistent(*value, args[0]);
+  char handle[HandleTable<v8::Persistent<v8::Value>*>::kHandleLength];
+  if (!handles || !handles->Add(value, handle)) {
+    NanDisposePersistent(*value);
+    delete value;
+    sftp_reply_status(m->message, SSH_FX_FAILURE, "Too many open handles");
+    NanReturnValue(NanFalse());
+  }
 
-  NanReturnUndefined();
+  ssh_string s = ssh_string_new(sizeof(handle));
+  ssh_string_fill(s, handle, sizeof(handle));
+  sftp_reply_handle(m->message, s);
+  ssh_string_free(s);
+
+  NanReturnValue(NanTrue());
 }
 
 NAN_METHOD(SftpMessage::ReplyStatus) {
@@ -553,6 +561,10 @@ NAN_METHOD(SftpMessage::ReplyStatus) {
     sftp_reply_status(m->message, status_code, NULL);
   }
 
+  // closed or not, the client won't use it again
+  if (m->message->type == SSH_FXP_CLOSE)
+    m->channel->ReleaseSftpHandle(m->message->handle);
+
   NanReturnUndefined();
 }
 
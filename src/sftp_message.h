@@ -32,8 +32,13 @@ class SftpMessage : public node::ObjectWrap {
   sftp_client_message message;
   ssh_session session;
   Channel *channel;
+  // what JS gave replyHandle() for the message's handle
+  v8::Persistent<v8::Value> handleValue;
+  // a WRITE's data, once it has been asked for
+  v8::Persistent<v8::Object> writeData;
 
   static NAN_METHOD(New);
+  static NAN_GETTER(GetField);
   static NAN_METHOD(ReplyName);
   static NAN_METHOD(ReplyNames);
   static NAN_METHOD(ReplyAttr);
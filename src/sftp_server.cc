@@ -0,0 +1,1045 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "sftp_server.h"
+#include "sftp_message.h"
+
+namespace nssh {
+
+// one client request, from the channel to its reply
+struct SftpRequest {
+  uv_fs_t req;
+  SftpServer *server;
+  sftp_client_message message;
+  // what it has to wait for before it can start
+  int scope;
+  SftpHandle *handle;
+  // real paths, inside the root
+  std::string path;
+  std::string target;
+  // a READDIR reply as it's built
+  std::string packet;
+  uint32_t count;
+  // a READ reply, the data is read in after the header
+  char *buffer;
+  uv_file fd;
+  size_t written;
+  int step;
+};
+
+static const int kFileHandle = 1;
+static const int kDirHandle = 2;
+
+// READs and WRITEs on a handle run alongside each other, anything else on
+// a handle waits for them and holds the handle until it's done, and
+// requests naming a path wait for everything and run alone
+enum {
+    kScopeShared
+  , kScopeHandle
+  , kScopeAll
+};
+
+static int RequestScope (uint8_t type) {
+  switch (type) {
+    case SSH_FXP_READ:
+    case SSH_FXP_WRITE:
+      return kScopeShared;
+    case SSH_FXP_CLOSE:
+    case SSH_FXP_FSTAT:
+    case SSH_FXP_FSETSTAT:
+    case SSH_FXP_READDIR:
+      return kScopeHandle;
+    default:
+      return kScopeAll;
+  }
+}
+
+// SETSTAT / FSETSTAT apply each attribute in turn
+enum {
+    kSetStatOpen
+  , kSetStatTruncate
+  , kSetStatClose
+  , kSetStatOwner
+  , kSetStatMode
+  , kSetStatTimes
+  , kSetStatDone
+};
+
+// the length of the header before a DATA reply's data
+#define NSSH_SFTP_DATA_HEADER 13
+
+static inline void PutU32At (char *p, uint32_t value) {
+  p[0] = (char)(value >> 24);
+  p[1] = (char)(value >> 16);
+  p[2] = (char)(value >> 8);
+  p[3] = (char)value;
+}
+
+static inline void PutU32 (std::string &packet, uint32_t value) {
+  char p[4];
+  PutU32At(p, value);
+  packet.append(p, 4);
+}
+
+static inline void PutU64 (std::string &packet, uint64_t value) {
+  PutU32(packet, (uint32_t)(value >> 32));
+  PutU32(packet, (uint32_t)value);
+}
+
+static inline void PutString (std::string &packet, const std::string &str) {
+  PutU32(packet, str.size());
+  packet.append(str);
+}
+
+// room for the length, which Send() fills in, then the type and the id
+// the client gave the request (libssh leaves it in network order)
+static inline void BeginPacket (
+      std::string &packet
+    , uint8_t type
+    , sftp_client_message message
+  ) {
+
+  packet.assign(4, '\0');
+  packet.append(1, (char)type);
+  packet.append(reinterpret_cast<const char*>(&message->id), 4);
+}
+
+static void PutAttrs (std::string &packet, const uv_stat_t *stat) {
+  if (!stat) {
+    PutU32(packet, 0);
+    return;
+  }
+  PutU32(packet
+    , SSH_FILEXFER_ATTR_SIZE
+    | SSH_FILEXFER_ATTR_UIDGID
+    | SSH_FILEXFER_ATTR_PERMISSIONS
+    | SSH_FILEXFER_ATTR_ACMODTIME
+  );
+  PutU64(packet, stat->st_size);
+  PutU32(packet, stat->st_uid);
+  PutU32(packet, stat->st_gid);
+  PutU32(packet, stat->st_mode);
+  PutU32(packet, stat->st_atim.tv_sec);
+  PutU32(packet, stat->st_mtim.tv_sec);
+}
+
+// what `ls -l` would say, clients show it as-is
+static std::string LongName (const std::string &name, const uv_stat_t *stat) {
+  if (!stat)
+    return name;
+
+  char mode[11] = "----------";
+  switch (stat->st_mode & S_IFMT) {
+    case S_IFDIR: mode[0] = 'd'; break;
+    case S_IFCHR: mode[0] = 'c'; break;
+#ifdef S_IFLNK
+    case S_IFLNK: mode[0] = 'l'; break;
+#endif
+#ifdef S_IFBLK
+    case S_IFBLK: mode[0] = 'b'; break;
+#endif
+#ifdef S_IFIFO
+    case S_IFIFO: mode[0] = 'p'; break;
+#endif
+  }
+  const char *rwx = "rwxrwxrwx";
+  for (int i = 0; i < 9; i++) {
+    if (stat->st_mode & (0400 >> i))
+      mode[i + 1] = rwx[i];
+  }
+
+  char date[16] = "";
+  time_t mtime = stat->st_mtim.tv_sec;
+  struct tm *tm = localtime(&mtime);
+  if (tm) {
+    // older than six months gets the year instead of the time, like ls
+    bool recent = time(NULL) - mtime < 182 * 24 * 60 * 60;
+    strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", tm);
+  }
+
+  char line[128];
+  snprintf(line, sizeof(line), "%s %3llu %-8llu %-8llu %8llu %s "
+    , mode
+    , (unsigned long long)stat->st_nlink
+    , (unsigned long long)stat->st_uid
+    , (unsigned long long)stat->st_gid
+    , (unsigned long long)stat->st_size
+    , date
+  );
+  return std::string(line) + name;
+}
+
+// client paths are relative to "/", which is the root, and can't climb
+// out of it with ".."
+static std::string NormalizePath (const char *path) {
+  std::vector<std::string> parts;
+  const char *p = path ? path : "";
+
+  while (*p) {
+    while (*p == '/')
+      p++;
+    const char *start = p;
+    while (*p && *p != '/')
+      p++;
+    std::string part(start, p - start);
+    if (part.empty() || part == ".")
+      continue;
+    if (part == "..") {
+      if (!parts.empty())
+        parts.pop_back();
+      continue;
+    }
+    parts.push_back(part);
+  }
+
+  std::string normalized;
+  for (size_t i = 0; i < parts.size(); i++) {
+    normalized.append("/");
+    normalized.append(parts[i]);
+  }
+  return normalized.empty() ? "/" : normalized;
+}
+
+static uint32_t ErrorToStatus (int error) {
+  switch (error) {
+    case 0:
+      return SSH_FX_OK;
+    case UV_ENOENT:
+    case UV_ENOTDIR:
+      return SSH_FX_NO_SUCH_FILE;
+    case UV_EACCES:
+    case UV_EPERM:
+    case UV_EROFS:
+      return SSH_FX_PERMISSION_DENIED;
+    default:
+      return SSH_FX_FAILURE;
+  }
+}
+
+#if UV_VERSION_MAJOR >= 1
+
+SftpServer::SftpServer (size_t maxHandles) : handles(maxHandles) {
+  channel = NULL;
+  filter = NULL;
+  inFlight = 0;
+  exclusive = false;
+  waiting = NULL;
+  outputBlocked = false;
+  detached = false;
+}
+
+SftpServer::~SftpServer () {
+  if (filter)
+    delete filter;
+}
+
+SftpServer *SftpServer::New (
+      const char *root
+    , v8::Handle<v8::Value> filter
+    , size_t maxHandles
+    , std::string &error
+  ) {
+
+  uv_fs_t req;
+  int rc = uv_fs_stat(uv_default_loop(), &req, root, NULL);
+  bool isDir = rc == 0 && (req.statbuf.st_mode & S_IFMT) == S_IFDIR;
+  uv_fs_req_cleanup(&req);
+  if (!isDir) {
+    error.assign("SFTP root is not a directory: ");
+    error.append(root);
+    return NULL;
+  }
+
+  SftpServer *s = new SftpServer(maxHandles);
+  s->root.assign(root);
+  while (!s->root.empty() && s->root[s->root.size() - 1] == '/')
+    s->root.erase(s->root.size() - 1);
+  if (filter->IsFunction())
+    s->filter = new NanCallback(filter.As<v8::Function>());
+
+  return s;
+}
+
+void SftpServer::Attach (Channel *channel) {
+  this->channel = channel;
+}
+
+bool SftpServer::Ready () {
+  if (waiting || inFlight >= NSSH_SFTP_MAX_REQUESTS)
+    return false;
+  if (channel && channel->QueuedLength() >= NSSH_SFTP_BUFFER) {
+    outputBlocked = true;
+    return false;
+  }
+  return true;
+}
+
+std::string SftpServer::RealPath (const std::string &path) {
+  if (path == "/")
+    return root.empty() ? "/" : root;
+  return root + path;
+}
+
+// the filter gets the client's paths, normalized, and returns false to
+// deny the request or a string to use in place of `path`
+bool SftpServer::Authorize (
+      SftpRequest *r
+    , const char *path
+    , const char *target
+  ) {
+
+  std::string virtualPath = NormalizePath(path);
+  std::string virtualTarget = target ? NormalizePath(target) : "";
+
+  if (filter) {
+    NanScope();
+
+    v8::Local<v8::Value> argv[] = {
+        NanNew<v8::String>(SftpMessage::MessageTypeToString(r->message->type))
+      , NanNew<v8::String>(virtualPath.c_str())
+      , target
+          ? v8::Local<v8::Value>(NanNew<v8::String>(virtualTarget.c_str()))
+          : v8::Local<v8::Value>(NanNull())
+    };
+    v8::Local<v8::Value> result = filter->Call(3, argv);
+
+    if (result.IsEmpty() || result->IsFalse()) {
+      SendStatus(r, SSH_FX_PERMISSION_DENIED, "Permission denied");
+      Done(r);
+      return false;
+    }
+    if (result->IsString()) {
+      v8::String::Utf8Value rewritten(result);
+      virtualPath = NormalizePath(*rewritten);
+    }
+  }
+
+  r->path = RealPath(virtualPath);
+  if (target)
+    r->target = RealPath(virtualTarget);
+  return true;
+}
+
+// the handle a request names, if it's one of ours
+void SftpServer::LookupHandle (SftpRequest *r) {
+  ssh_string handle = r->message->handle;
+  if (!handle)
+    return;
+  SftpHandle **h = handles.Find(
+      static_cast<const char*>(ssh_string_data(handle))
+    , ssh_string_len(handle)
+  );
+  if (h)
+    r->handle = *h;
+}
+
+SftpHandle *SftpServer::FindHandle (SftpRequest *r, int kind) {
+  SftpHandle *h = r->handle;
+  if (!h || !(kind & (h->isDir ? kDirHandle : kFileHandle))) {
+    SendStatus(r, SSH_FX_FAILURE, "Invalid handle");
+    Done(r);
+    return NULL;
+  }
+  return h;
+}
+
+// requests are started in the order they arrive, one that has to wait
+// holds up the rest until it can go
+void SftpServer::Handle (sftp_client_message message) {
+  SftpRequest *r = new SftpRequest;
+  memset(&r->req, 0, sizeof(r->req));
+  r->server = this;
+  r->message = message;
+  r->scope = RequestScope(message->type);
+  r->handle = NULL;
+  r->count = 0;
+  r->buffer = NULL;
+  r->fd = -1;
+  r->written = 0;
+  r->step = 0;
+
+  // the request rides along on the uv_fs_t
+  r->req.data = r;
+
+  LookupHandle(r);
+  if (CanStart(r))
+    Start(r);
+  else
+    waiting = r;
+}
+
+bool SftpServer::CanStart (SftpRequest *r) {
+  if (exclusive)
+    return false;
+  switch (r->scope) {
+    case kScopeShared:
+      return !r->handle || !r->handle->locked;
+    case kScopeHandle:
+      return !r->handle || (!r->handle->locked && !r->handle->inFlight);
+    default:
+      return !inFlight;
+  }
+}
+
+void SftpServer::Start (SftpRequest *r) {
+  sftp_client_message message = r->message;
+
+  if (NSSH_DEBUG)
+    std::cout << "SftpServer::Start " << (int)message->type << std::endl;
+
+  inFlight++;
+  if (r->handle) {
+    r->handle->inFlight++;
+    if (r->scope == kScopeHandle)
+      r->handle->locked = true;
+  }
+  if (r->scope == kScopeAll)
+    exclusive = true;
+
+  uv_loop_t *loop = uv_default_loop();
+  sftp_attributes attr = message->attr;
+  SftpHandle *h;
+  int rc = 0;
+
+  switch (message->type) {
+    case SSH_FXP_OPEN: {
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      int flags = (message->flags & SSH_FXF_WRITE)
+        ? (message->flags & SSH_FXF_READ) ? O_RDWR : O_WRONLY
+        : O_RDONLY;
+      if (message->flags & SSH_FXF_APPEND)
+        flags |= O_APPEND;
+      if (message->flags & SSH_FXF_CREAT)
+        flags |= O_CREAT;
+      if (message->flags & SSH_FXF_TRUNC)
+        flags |= O_TRUNC;
+      if (message->flags & SSH_FXF_EXCL)
+        flags |= O_EXCL;
+      int mode = attr && (attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+        ? attr->permissions & 07777
+        : 0666;
+      rc = uv_fs_open(loop, &r->req, r->path.c_str(), flags, mode, OpenCallback);
+      break;
+    }
+
+    case SSH_FXP_OPENDIR:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_scandir(loop, &r->req, r->path.c_str(), 0, OpenDirCallback);
+      break;
+
+    case SSH_FXP_CLOSE: {
+      if (!(h = FindHandle(r, kFileHandle | kDirHandle)))
+        return;
+      // nothing else is using it, we have it locked
+      handles.Remove(
+          static_cast<const char*>(ssh_string_data(message->handle))
+        , ssh_string_len(message->handle)
+      );
+      uv_file fd = h->fd;
+      bool isDir = h->isDir;
+      r->handle = NULL;
+      delete h;
+      if (isDir) {
+        SendStatus(r, 0);
+        Done(r);
+        return;
+      }
+      rc = uv_fs_close(loop, &r->req, fd, StatusCallback);
+      break;
+    }
+
+    case SSH_FXP_READ: {
+      if (!(h = FindHandle(r, kFileHandle)))
+        return;
+      size_t length = message->len < NSSH_SFTP_MAX_READ
+        ? message->len
+        : NSSH_SFTP_MAX_READ;
+      r->buffer = static_cast<char*>(malloc(NSSH_SFTP_DATA_HEADER + length));
+      uv_buf_t buf = uv_buf_init(r->buffer + NSSH_SFTP_DATA_HEADER, length);
+      rc = uv_fs_read(loop, &r->req, h->fd, &buf, 1, message->offset, ReadCallback);
+      break;
+    }
+
+    case SSH_FXP_WRITE:
+      if (!(h = FindHandle(r, kFileHandle)))
+        return;
+      r->fd = h->fd;
+      Write(r);
+      return;
+
+    case SSH_FXP_FSTAT:
+      if (!(h = FindHandle(r, kFileHandle)))
+        return;
+      rc = uv_fs_fstat(loop, &r->req, h->fd, StatCallback);
+      break;
+
+    case SSH_FXP_STAT:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_stat(loop, &r->req, r->path.c_str(), StatCallback);
+      break;
+
+    case SSH_FXP_LSTAT:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_lstat(loop, &r->req, r->path.c_str(), StatCallback);
+      break;
+
+    case SSH_FXP_READDIR:
+      if (!(h = FindHandle(r, kDirHandle)))
+        return;
+      if (h->nextEntry >= h->entries.size()) {
+        SendStatus(r, SSH_FX_EOF, "End of directory");
+        Done(r);
+        return;
+      }
+      BeginPacket(r->packet, SSH_FXP_NAME, message);
+      PutU32(r->packet, 0); // the count, once we know it
+      ReadDirNext(r);
+      return;
+
+    case SSH_FXP_SETSTAT:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      SetStatNext(r);
+      return;
+
+    case SSH_FXP_FSETSTAT:
+      if (!(h = FindHandle(r, kFileHandle)))
+        return;
+      r->fd = h->fd;
+      SetStatNext(r);
+      return;
+
+    case SSH_FXP_REMOVE:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_unlink(loop, &r->req, r->path.c_str(), StatusCallback);
+      break;
+
+    case SSH_FXP_MKDIR: {
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      int mode = attr && (attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS)
+        ? attr->permissions & 07777
+        : 0777;
+      rc = uv_fs_mkdir(loop, &r->req, r->path.c_str(), mode, StatusCallback);
+      break;
+    }
+
+    case SSH_FXP_RMDIR:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_rmdir(loop, &r->req, r->path.c_str(), StatusCallback);
+      break;
+
+    case SSH_FXP_RENAME:
+      if (!Authorize(r, message->filename, sftp_client_message_get_data(message)))
+        return;
+      rc = uv_fs_rename(
+          loop
+        , &r->req
+        , r->path.c_str()
+        , r->target.c_str()
+        , StatusCallback
+      );
+      break;
+
+    case SSH_FXP_SYMLINK: {
+      // OpenSSH sends the target first, everyone follows it
+      // a relative target is relative to the link's directory, resolve it
+      // here so it gets clamped to the root like any other path, a raw
+      // "../../etc" would otherwise be followed straight out of it
+      const char *linkpath = sftp_client_message_get_data(message);
+      std::string target(message->filename ? message->filename : "");
+      if (target.empty() || target[0] != '/') {
+        std::string dir = NormalizePath(linkpath);
+        dir.erase(dir.rfind('/') + 1);
+        target = dir + target;
+      }
+      if (!Authorize(r, linkpath, target.c_str()))
+        return;
+      rc = uv_fs_symlink(
+          loop
+        , &r->req
+        , r->target.c_str()
+        , r->path.c_str()
+        , 0
+        , StatusCallback
+      );
+      break;
+    }
+
+    case SSH_FXP_READLINK:
+      if (!Authorize(r, message->filename, NULL))
+        return;
+      rc = uv_fs_readlink(loop, &r->req, r->path.c_str(), ReadLinkCallback);
+      break;
+
+    case SSH_FXP_REALPATH:
+      // nothing touches the disk, it's all relative to the root anyway
+      SendName(r, NormalizePath(message->filename));
+      Done(r);
+      return;
+
+    default:
+      SendStatus(r, SSH_FX_OP_UNSUPPORTED, "Unsupported request");
+      Done(r);
+      return;
+  }
+
+  if (rc < 0) {
+    SendStatus(r, rc);
+    Done(r);
+  }
+}
+
+void SftpServer::OpenCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SendStatus(r, req->result);
+  } else {
+    SftpHandle *h = new SftpHandle;
+    h->fd = req->result;
+    h->isDir = false;
+    h->nextEntry = 0;
+    h->inFlight = 0;
+    h->locked = false;
+    s->AddHandle(r, h);
+  }
+  s->Done(r);
+}
+
+void SftpServer::OpenDirCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SendStatus(r, req->result);
+  } else {
+    SftpHandle *h = new SftpHandle;
+    h->fd = -1;
+    h->isDir = true;
+    h->path = r->path;
+    h->nextEntry = 0;
+    h->inFlight = 0;
+    h->locked = false;
+    uv_dirent_t entry;
+    while (uv_fs_scandir_next(req, &entry) != UV_EOF)
+      h->entries.push_back(entry.name);
+    s->AddHandle(r, h);
+  }
+  s->Done(r);
+}
+
+void SftpServer::ReadCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SendStatus(r, req->result);
+  } else if (req->result == 0) {
+    s->SendStatus(r, SSH_FX_EOF, "End of file");
+  } else {
+    // the data is already in place behind the header
+    uint32_t length = req->result;
+    char *p = r->buffer;
+    PutU32At(p, NSSH_SFTP_DATA_HEADER - 4 + length);
+    p[4] = SSH_FXP_DATA;
+    memcpy(p + 5, &r->message->id, 4);
+    PutU32At(p + 9, length);
+    s->SendBuffer(r->buffer, NSSH_SFTP_DATA_HEADER + length);
+    r->buffer = NULL;
+  }
+  s->Done(r);
+}
+
+// a short write carries on from where it stopped
+void SftpServer::Write (SftpRequest *r) {
+  ssh_string data = r->message->data;
+  uv_buf_t buf = uv_buf_init(
+      static_cast<char*>(ssh_string_data(data)) + r->written
+    , ssh_string_len(data) - r->written
+  );
+
+  uv_fs_req_cleanup(&r->req);
+  int rc = uv_fs_write(
+      uv_default_loop()
+    , &r->req
+    , r->fd
+    , &buf
+    , 1
+    , r->message->offset + r->written
+    , WriteCallback
+  );
+  if (rc < 0) {
+    SendStatus(r, rc);
+    Done(r);
+  }
+}
+
+void SftpServer::WriteCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SendStatus(r, req->result);
+  } else {
+    r->written += req->result;
+    if (req->result > 0 && r->written < ssh_string_len(r->message->data)) {
+      s->Write(r);
+      return;
+    }
+    s->SendStatus(r, 0);
+  }
+  s->Done(r);
+}
+
+void SftpServer::StatCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0)
+    s->SendStatus(r, req->result);
+  else
+    s->SendAttrs(r, &req->statbuf);
+  s->Done(r);
+}
+
+void SftpServer::StatusCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  s->SendStatus(r, req->result < 0 ? req->result : 0);
+  s->Done(r);
+}
+
+void SftpServer::ReadLinkCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SendStatus(r, req->result);
+  } else {
+    // links into the root are shown as the client sees the root
+    std::string link(static_cast<const char*>(req->ptr));
+    if (!s->root.empty() && link.compare(0, s->root.size() + 1, s->root + "/") == 0)
+      link.erase(0, s->root.size());
+    s->SendName(r, link);
+  }
+  s->Done(r);
+}
+
+// entries go out NSSH_SFTP_READDIR_COUNT at a time, each with its lstat
+void SftpServer::ReadDirNext (SftpRequest *r) {
+  SftpHandle *h = r->handle;
+
+  while (r->count < NSSH_SFTP_READDIR_COUNT && h->nextEntry < h->entries.size()) {
+    const std::string &name = h->entries[h->nextEntry];
+    uv_fs_req_cleanup(&r->req);
+    int rc = uv_fs_lstat(
+        uv_default_loop()
+      , &r->req
+      , (h->path + "/" + name).c_str()
+      , ReadDirCallback
+    );
+    if (rc == 0)
+      return;
+    // can't stat it, list it anyway
+    PutString(r->packet, name);
+    PutString(r->packet, name);
+    PutAttrs(r->packet, NULL);
+    r->count++;
+    h->nextEntry++;
+  }
+
+  PutU32At(&r->packet[9], r->count);
+  Send(r->packet);
+  Done(r);
+}
+
+void SftpServer::ReadDirCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+  SftpHandle *h = r->handle;
+  const std::string &name = h->entries[h->nextEntry];
+  const uv_stat_t *stat = req->result < 0 ? NULL : &req->statbuf;
+
+  PutString(r->packet, name);
+  PutString(r->packet, LongName(name, stat));
+  PutAttrs(r->packet, stat);
+  r->count++;
+  h->nextEntry++;
+  s->ReadDirNext(r);
+}
+
+void SftpServer::SetStatNext (SftpRequest *r) {
+  sftp_attributes attr = r->message->attr;
+  uv_loop_t *loop = uv_default_loop();
+  bool hasSize = attr && (attr->flags & SSH_FILEXFER_ATTR_SIZE);
+  const char *path = r->path.c_str();
+  int rc = 0;
+
+  while (attr && r->step < kSetStatDone) {
+    uv_fs_req_cleanup(&r->req);
+
+    switch (r->step++) {
+      case kSetStatOpen: // truncating a path takes an fd of our own
+        if (!hasSize || r->handle)
+          continue;
+        rc = uv_fs_open(loop, &r->req, path, O_WRONLY, 0, SetStatCallback);
+        break;
+      case kSetStatTruncate:
+        if (!hasSize)
+          continue;
+        rc = uv_fs_ftruncate(loop, &r->req, r->fd, attr->size, SetStatCallback);
+        break;
+      case kSetStatClose:
+        if (!hasSize || r->handle)
+          continue;
+        rc = uv_fs_close(loop, &r->req, r->fd, SetStatCallback);
+        r->fd = -1;
+        break;
+      case kSetStatOwner:
+        if (!(attr->flags & SSH_FILEXFER_ATTR_UIDGID))
+          continue;
+        rc = r->handle
+          ? uv_fs_fchown(loop, &r->req, r->fd, attr->uid, attr->gid, SetStatCallback)
+          : uv_fs_chown(loop, &r->req, path, attr->uid, attr->gid, SetStatCallback);
+        break;
+      case kSetStatMode:
+        if (!(attr->flags & SSH_FILEXFER_ATTR_PERMISSIONS))
+          continue;
+        rc = r->handle
+          ? uv_fs_fchmod(loop, &r->req, r->fd, attr->permissions & 07777, SetStatCallback)
+          : uv_fs_chmod(loop, &r->req, path, attr->permissions & 07777, SetStatCallback);
+        break;
+      case kSetStatTimes:
+        if (!(attr->flags & SSH_FILEXFER_ATTR_ACMODTIME))
+          continue;
+        rc = r->handle
+          ? uv_fs_futime(loop, &r->req, r->fd, attr->atime, attr->mtime, SetStatCallback)
+          : uv_fs_utime(loop, &r->req, path, attr->atime, attr->mtime, SetStatCallback);
+        break;
+    }
+
+    if (rc == 0)
+      return; // SetStatCallback() brings us back
+    SetStatFailed(r, rc);
+    return;
+  }
+
+  SendStatus(r, 0);
+  Done(r);
+}
+
+void SftpServer::SetStatCallback (uv_fs_t *req) {
+  SftpRequest *r = static_cast<SftpRequest*>(req->data);
+  SftpServer *s = r->server;
+
+  if (req->result < 0) {
+    s->SetStatFailed(r, req->result);
+    return;
+  }
+  if (r->step == kSetStatOpen + 1)
+    r->fd = req->result;
+  s->SetStatNext(r);
+}
+
+void SftpServer::SetStatFailed (SftpRequest *r, int error) {
+  // our own fd from truncating a path
+  if (!r->handle && r->fd >= 0) {
+    uv_fs_t *req = new uv_fs_t;
+    uv_fs_close(uv_default_loop(), req, r->fd, DiscardCallback);
+    r->fd = -1;
+  }
+  SendStatus(r, error);
+  Done(r);
+}
+
+void SftpServer::DiscardCallback (uv_fs_t *req) {
+  uv_fs_req_cleanup(req);
+  delete req;
+}
+
+void SftpServer::SendStatus (SftpRequest *r, int error) {
+  SendStatus(r, ErrorToStatus(error), error ? uv_strerror(error) : "Success");
+}
+
+void SftpServer::SendStatus (
+      SftpRequest *r
+    , uint32_t status
+    , const char *message
+  ) {
+
+  std::string packet;
+  BeginPacket(packet, SSH_FXP_STATUS, r->message);
+  PutU32(packet, status);
+  PutString(packet, message);
+  PutString(packet, ""); // language
+  Send(packet);
+}
+
+// replies with the new handle, or a failure if the client has too many
+void SftpServer::AddHandle (SftpRequest *r, SftpHandle *h) {
+  char handle[HandleTable<SftpHandle*>::kHandleLength];
+
+  if (!handles.Add(h, handle)) {
+    if (!h->isDir) {
+      uv_fs_t *req = new uv_fs_t;
+      uv_fs_close(uv_default_loop(), req, h->fd, DiscardCallback);
+    }
+    delete h;
+    SendStatus(r, SSH_FX_FAILURE, "Too many open handles");
+    return;
+  }
+
+  std::string packet;
+  BeginPacket(packet, SSH_FXP_HANDLE, r->message);
+  PutString(packet, std::string(handle, sizeof(handle)));
+  Send(packet);
+}
+
+void SftpServer::SendAttrs (SftpRequest *r, const uv_stat_t *stat) {
+  std::string packet;
+  BeginPacket(packet, SSH_FXP_ATTRS, r->message);
+  PutAttrs(packet, stat);
+  Send(packet);
+}
+
+void SftpServer::SendName (SftpRequest *r, const std::string &name) {
+  std::string packet;
+  BeginPacket(packet, SSH_FXP_NAME, r->message);
+  PutU32(packet, 1);
+  PutString(packet, name);
+  PutString(packet, name);
+  PutAttrs(packet, NULL);
+  Send(packet);
+}
+
+void SftpServer::Send (std::string &packet) {
+  PutU32At(&packet[0], packet.size() - 4);
+  char *data = static_cast<char*>(malloc(packet.size()));
+  memcpy(data, packet.data(), packet.size());
+  SendBuffer(data, packet.size());
+}
+
+// replies take their turn in the channel's write queue behind the window
+void SftpServer::SendBuffer (char *data, size_t length) {
+  if (!channel) {
+    free(data);
+    return;
+  }
+  channel->WriteNative(data, length, this);
+}
+
+void SftpServer::WriteDone (char *data, const char *error) {
+  free(data);
+  if (outputBlocked && channel && channel->QueuedLength() < NSSH_SFTP_BUFFER) {
+    outputBlocked = false;
+    channel->Wake();
+  }
+}
+
+void SftpServer::Done (SftpRequest *r) {
+  inFlight--;
+  if (r->handle) {
+    r->handle->inFlight--;
+    if (r->scope == kScopeHandle)
+      r->handle->locked = false;
+  }
+  if (r->scope == kScopeAll)
+    exclusive = false;
+  Free(r);
+
+  if (detached) {
+    if (!inFlight) {
+      CloseHandles();
+      delete this;
+    }
+    return;
+  }
+
+  if (waiting && CanStart(waiting)) {
+    SftpRequest *next = waiting;
+    waiting = NULL;
+    Start(next);
+  }
+  if (channel)
+    channel->Wake();
+}
+
+void SftpServer::Free (SftpRequest *r) {
+  uv_fs_req_cleanup(&r->req);
+  if (r->buffer)
+    free(r->buffer);
+  sftp_client_message_free(r->message);
+  delete r;
+}
+
+// the channel has gone, in-flight requests still have their fds so the
+// handles are closed once they've finished
+void SftpServer::Detach () {
+  channel = NULL;
+  detached = true;
+
+  if (waiting) {
+    Free(waiting);
+    waiting = NULL;
+  }
+  if (!inFlight) {
+    CloseHandles();
+    delete this;
+  }
+}
+
+void SftpServer::CloseHandles () {
+  for (size_t i = 0; i < handles.Slots(); i++) {
+    SftpHandle **h = handles.At(i);
+    if (!h)
+      continue;
+    if (!(*h)->isDir) {
+      uv_fs_t *req = new uv_fs_t;
+      uv_fs_close(uv_default_loop(), req, (*h)->fd, DiscardCallback);
+    }
+    delete *h;
+  }
+  handles.Clear();
+}
+
+#else // libuv 0.10's fs APIs aren't worth supporting here
+
+SftpServer::SftpServer (size_t maxHandles) : handles(maxHandles) {}
+SftpServer::~SftpServer () {}
+
+SftpServer *SftpServer::New (
+      const char *root
+    , v8::Handle<v8::Value> filter
+    , size_t maxHandles
+    , std::string &error
+  ) {
+
+  error.assign("A native SFTP root requires node 0.12 or later");
+  return NULL;
+}
+
+void SftpServer::Attach (Channel *channel) {}
+bool SftpServer::Ready () { return false; }
+void SftpServer::Handle (sftp_client_message message) {}
+void SftpServer::Detach () {}
+void SftpServer::WriteDone (char *data, const char *error) {}
+
+#endif
+
+} // namespace nssh
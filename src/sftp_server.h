@@ -0,0 +1,118 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_SFTP_SERVER_H
+#define NSSH_SFTP_SERVER_H
+
+#include <node.h>
+#include <uv.h>
+#include <libssh/server.h>
+#include <libssh/sftp.h>
+#include <nan.h>
+#include <string>
+#include <vector>
+
+#include "nssh.h"
+#include "channel.h"
+#include "handle_table.h"
+
+namespace nssh {
+
+struct SftpRequest;
+
+// an open file or directory
+struct SftpHandle {
+  uv_file fd;
+  bool isDir;
+  // for directories, what's left to list and where it lives
+  std::string path;
+  std::vector<std::string> entries;
+  size_t nextEntry;
+  // requests using it, and whether one of them needs it to itself
+  int inFlight;
+  bool locked;
+};
+
+// serves a channel's SFTP requests from a directory on disk without going
+// through JS, sftpAccept({ root }). Requests are run with libuv fs on the
+// threadpool, up to NSSH_SFTP_MAX_REQUESTS at once, and their replies
+// queued on the channel behind the client's window as each completes. An
+// optional `filter` function is called for requests naming a path and can
+// deny them or rewrite the path.
+class SftpServer : public ChannelWriter {
+ public:
+  // NULL with `error` set if `root` isn't a directory, the client can have
+  // up to `maxHandles` files and directories open
+  static SftpServer *New (
+      const char *root
+    , v8::Handle<v8::Value> filter
+    , size_t maxHandles
+    , std::string &error
+  );
+
+  void Attach (Channel *channel);
+  // false while we can't take another request, the channel is woken when
+  // we can
+  bool Ready ();
+  void Handle (sftp_client_message message);
+  // the channel has gone, we go once nothing is in flight
+  void Detach ();
+
+  void WriteDone (char *data, const char *error);
+
+ private:
+  SftpServer (size_t maxHandles);
+  ~SftpServer ();
+
+  static void OpenCallback (uv_fs_t *req);
+  static void OpenDirCallback (uv_fs_t *req);
+  static void ReadCallback (uv_fs_t *req);
+  static void WriteCallback (uv_fs_t *req);
+  static void StatCallback (uv_fs_t *req);
+  static void StatusCallback (uv_fs_t *req);
+  static void ReadLinkCallback (uv_fs_t *req);
+  static void ReadDirCallback (uv_fs_t *req);
+  static void SetStatCallback (uv_fs_t *req);
+  static void DiscardCallback (uv_fs_t *req);
+
+  bool Authorize (SftpRequest *r, const char *path, const char *target);
+  std::string RealPath (const std::string &path);
+  void LookupHandle (SftpRequest *r);
+  SftpHandle *FindHandle (SftpRequest *r, int kind);
+  bool CanStart (SftpRequest *r);
+  void Start (SftpRequest *r);
+  void ReadDirNext (SftpRequest *r);
+  void SetStatNext (SftpRequest *r);
+  void SetStatFailed (SftpRequest *r, int error);
+  void Write (SftpRequest *r);
+
+  void SendStatus (SftpRequest *r, int error);
+  void SendStatus (SftpRequest *r, uint32_t status, const char *message);
+  void AddHandle (SftpRequest *r, SftpHandle *h);
+  void SendAttrs (SftpRequest *r, const uv_stat_t *stat);
+  void SendName (SftpRequest *r, const std::string &name);
+  void Send (std::string &packet);
+  void SendBuffer (char *data, size_t length);
+  void Done (SftpRequest *r);
+  void Free (SftpRequest *r);
+  void CloseHandles ();
+
+  Channel *channel;
+  std::string root;
+  NanCallback *filter;
+  size_t inFlight;
+  // a request that has to run alone has started
+  bool exclusive;
+  // the next request, until whatever is in its way finishes
+  SftpRequest *waiting;
+  // waiting on the channel's write queue to drain
+  bool outputBlocked;
+  // the channel has closed, we delete ourselves once idle
+  bool detached;
+  HandleTable<SftpHandle*> handles;
+};
+
+} // namespace nssh
+
+#endif
@@ -0,0 +1,168 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <string.h>
+#include "tcp_forward.h"
+#include "tcp_relay.h"
+#include "session.h"
+
+namespace nssh {
+
+#if UV_VERSION_MAJOR >= 1
+
+// tcpip-forward addresses are either an IP or one of the names from
+// RFC 4254 7.1, we don't resolve anything else
+static int ForwardAddress (
+      const char *host
+    , int port
+    , struct sockaddr_storage *addr
+  ) {
+
+  if (!host || !*host || !strcmp(host, "*") || !strcmp(host, "0.0.0.0"))
+    host = "0.0.0.0";
+  else if (!strcmp(host, "localhost"))
+    host = "127.0.0.1";
+
+  struct sockaddr_in *addr4 = reinterpret_cast<struct sockaddr_in*>(addr);
+  if (uv_ip4_addr(host, port, addr4) == 0)
+    return 0;
+  struct sockaddr_in6 *addr6 = reinterpret_cast<struct sockaddr_in6*>(addr);
+  return uv_ip6_addr(host, port, addr6);
+}
+
+TcpForward::TcpForward (Session *session, ssh_session sshSession) {
+  this->session = session;
+  this->sshSession = sshSession;
+  port = 0;
+  nextForward = NULL;
+}
+
+TcpForward *TcpForward::Listen (
+      Session *session
+    , ssh_session sshSession
+    , const char *address
+    , int port
+    , const char *bindHost
+    , int bindPort
+    , std::string &error
+  ) {
+
+  struct sockaddr_storage addr;
+  int rc = ForwardAddress(bindHost, bindPort, &addr);
+  if (rc) {
+    error.assign("Can't listen on ");
+    error.append(bindHost);
+    return NULL;
+  }
+
+  TcpForward *f = new TcpForward(session, sshSession);
+  f->address.assign(address ? address : "");
+  uv_tcp_init(uv_default_loop(), &f->server);
+  f->server.data = f;
+
+  rc = uv_tcp_bind(&f->server, reinterpret_cast<struct sockaddr*>(&addr), 0);
+  if (!rc) {
+    rc = uv_listen(
+        reinterpret_cast<uv_stream_t*>(&f->server)
+      , SOMAXCONN
+      , ConnectionCallback
+    );
+  }
+  if (rc) {
+    error.assign("Error listening for forwarded connections: ");
+    error.append(uv_strerror(rc));
+    f->Close();
+    return NULL;
+  }
+
+  // the client is told about the port we got if it left it to us
+  f->port = port;
+  if (!port) {
+    struct sockaddr_storage bound;
+    int length = sizeof(bound);
+    uv_tcp_getsockname(
+        &f->server
+      , reinterpret_cast<struct sockaddr*>(&bound)
+      , &length
+    );
+    f->port = bound.ss_family == AF_INET6
+      ? ntohs(reinterpret_cast<struct sockaddr_in6*>(&bound)->sin6_port)
+      : ntohs(reinterpret_cast<struct sockaddr_in*>(&bound)->sin_port);
+  }
+
+  if (NSSH_DEBUG)
+    std::cout << "TcpForward::Listen " << f->address << ":" << f->port << std::endl;
+
+  return f;
+}
+
+bool TcpForward::Matches (const char *address, int port) {
+  return this->port == port && this->address == (address ? address : "");
+}
+
+int TcpForward::Port () {
+  return port;
+}
+
+void TcpForward::ConnectionCallback (uv_stream_t *server, int status) {
+  TcpForward *f = static_cast<TcpForward*>(server->data);
+
+  if (status < 0)
+    return;
+
+  uv_tcp_t *tcp = new uv_tcp_t;
+  uv_tcp_init(uv_default_loop(), tcp);
+  if (uv_accept(server, reinterpret_cast<uv_stream_t*>(tcp))) {
+    uv_close(reinterpret_cast<uv_handle_t*>(tcp), RejectedCallback);
+    return;
+  }
+
+  TcpRelay::Open(f->session, f->sshSession, tcp, f->address.c_str(), f->port);
+}
+
+void TcpForward::Close () {
+  uv_close(reinterpret_cast<uv_handle_t*>(&server), ClosedCallback);
+}
+
+void TcpForward::ClosedCallback (uv_handle_t *handle) {
+  TcpForward *f = static_cast<TcpForward*>(handle->data);
+  if (NSSH_DEBUG)
+    std::cout << "TcpForward closed " << f->address << ":" << f->port << std::endl;
+  delete f;
+}
+
+void TcpForward::RejectedCallback (uv_handle_t *handle) {
+  delete reinterpret_cast<uv_tcp_t*>(handle);
+}
+
+#else // libuv 0.10's tcp APIs aren't worth supporting here
+
+TcpForward *TcpForward::Listen (
+      Session *session
+    , ssh_session sshSession
+    , const char *address
+    , int port
+    , const char *bindHost
+    , int bindPort
+    , std::string &error
+  ) {
+
+  error.assign("Port forwarding requires node 0.12 or later");
+  return NULL;
+}
+
+bool TcpForward::Matches (const char *address, int port) {
+  return false;
+}
+
+int TcpForward::Port () {
+  return 0;
+}
+
+void TcpForward::Close () {}
+
+#endif
+
+} // namespace nssh
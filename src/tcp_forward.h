@@ -0,0 +1,60 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_TCP_FORWARD_H
+#define NSSH_TCP_FORWARD_H
+
+#include <node.h>
+#include <uv.h>
+#include <libssh/server.h>
+#include <string>
+
+#include "nssh.h"
+
+namespace nssh {
+
+class Session;
+
+// a listening socket for a client's tcpip-forward, every connection it
+// accepts gets a forwarded-tcpip channel back to the client with a
+// TcpRelay splicing the two. Belongs to the Session, which closes it on
+// cancel-tcpip-forward or when it closes itself.
+class TcpForward {
+ public:
+  // listens on bindHost:bindPort, `address` and `port` are what the client
+  // asked for and are what it's told about each connection (a `port` of 0
+  // becomes the port we got). Returns NULL with `error` set on failure.
+  static TcpForward *Listen (
+      Session *session
+    , ssh_session sshSession
+    , const char *address
+    , int port
+    , const char *bindHost
+    , int bindPort
+    , std::string &error
+  );
+
+  bool Matches (const char *address, int port);
+  int Port ();
+  void Close ();
+
+  TcpForward *nextForward;
+
+ private:
+  TcpForward (Session *session, ssh_session sshSession);
+
+  static void ConnectionCallback (uv_stream_t *server, int status);
+  static void ClosedCallback (uv_handle_t *handle);
+  static void RejectedCallback (uv_handle_t *handle);
+
+  Session *session;
+  ssh_session sshSession;
+  std::string address;
+  int port;
+  uv_tcp_t server;
+};
+
+} // namespace nssh
+
+#endif
@@ -0,0 +1,447 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+#include <node.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcp_relay.h"
+#include "session.h"
+
+namespace nssh {
+
+#if UV_VERSION_MAJOR >= 1
+
+// a chunk of channel data on its way to the socket
+struct RelayWrite {
+  uv_write_t req;
+  char *data;
+  size_t length;
+};
+
+TcpRelay::TcpRelay (Session *session) {
+  this->session = session;
+  NanAssignPersistent(sessionHandle, NanObjectWrapHandle(session));
+  message = NULL;
+  opening = NULL;
+  openPort = 0;
+  originPort = 0;
+  channel = NULL;
+  tcp = NULL;
+  closing = false;
+  tcpEof = false;
+  shutdown = false;
+  inputStopped = false;
+  outputStopped = false;
+  writeQueued = 0;
+  resolveReq.data = this;
+  connectReq.data = this;
+}
+
+void TcpRelay::Connect (
+      Session *session
+    , ssh_message message
+    , const char *host
+    , int port
+  ) {
+
+  TcpRelay *r = new TcpRelay(session);
+  r->message = message;
+
+  char service[16];
+  snprintf(service, sizeof(service), "%d", port);
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (NSSH_DEBUG)
+    std::cout << "TcpRelay::Connect " << host << ":" << port << std::endl;
+
+  int rc = uv_getaddrinfo(
+      uv_default_loop()
+    , &r->resolveReq
+    , ResolvedCallback
+    , host
+    , service
+    , &hints
+  );
+  if (rc)
+    r->Refuse();
+}
+
+void TcpRelay::ResolvedCallback (
+      uv_getaddrinfo_t *req
+    , int status
+    , struct addrinfo *res
+  ) {
+
+  TcpRelay *r = static_cast<TcpRelay*>(req->data);
+
+  if (status < 0) {
+    r->Refuse();
+    return;
+  }
+
+  r->tcp = new uv_tcp_t;
+  uv_tcp_init(uv_default_loop(), r->tcp);
+  r->tcp->data = r;
+  int rc = uv_tcp_connect(&r->connectReq, r->tcp, res->ai_addr, ConnectCallback);
+  uv_freeaddrinfo(res);
+  if (rc)
+    r->Refuse();
+}
+
+void TcpRelay::ConnectCallback (uv_connect_t *req, int status) {
+  TcpRelay *r = static_cast<TcpRelay*>(req->data);
+
+  if (status < 0 || r->session->IsClosed()) {
+    r->Refuse();
+    return;
+  }
+
+  Channel *channel = r->session->AcceptChannel(r->message);
+  ssh_message_free(r->message);
+  r->message = NULL;
+  if (!channel) {
+    r->Close();
+    return;
+  }
+  r->Start(channel);
+}
+
+void TcpRelay::Open (
+      Session *session
+    , ssh_session sshSession
+    , uv_tcp_t *tcp
+    , const char *address
+    , int port
+  ) {
+
+  TcpRelay *r = new TcpRelay(session);
+  r->tcp = tcp;
+  tcp->data = r;
+  r->openAddress.assign(address);
+  r->openPort = port;
+
+  // the client is told who connected, for its logs
+  struct sockaddr_storage peer;
+  int length = sizeof(peer);
+  char name[INET6_ADDRSTRLEN] = "";
+  if (!uv_tcp_getpeername(tcp, reinterpret_cast<struct sockaddr*>(&peer), &length)) {
+    if (peer.ss_family == AF_INET6) {
+      struct sockaddr_in6 *peer6 = reinterpret_cast<struct sockaddr_in6*>(&peer);
+      uv_ip6_name(peer6, name, sizeof(name));
+      r->originPort = ntohs(peer6->sin6_port);
+    } else {
+      struct sockaddr_in *peer4 = reinterpret_cast<struct sockaddr_in*>(&peer);
+      uv_ip4_name(peer4, name, sizeof(name));
+      r->originPort = ntohs(peer4->sin_port);
+    }
+  }
+  r->originAddress.assign(name);
+
+  if (NSSH_DEBUG) {
+    std::cout << "TcpRelay::Open " << address << ":" << port << " from "
+      << r->originAddress << ":" << r->originPort << std::endl;
+  }
+
+  if (session->IsClosed()) {
+    r->Close();
+    return;
+  }
+
+  r->opening = ssh_channel_new(sshSession);
+  if (!r->opening) {
+    r->Close();
+    return;
+  }
+
+  // nonblocking, this only sends the request, the session reads the answer
+  // along with everything else and PollOpen() looks at what it was
+  int rc = ssh_channel_open_reverse_forward(
+      r->opening
+    , r->openAddress.c_str()
+    , r->openPort
+    , r->originAddress.c_str()
+    , r->originPort
+  );
+  if (rc == SSH_ERROR)
+    r->Cancel();
+  else if (r->PollOpen())
+    session->AddOpening(r);
+  // get the request out now rather than the next time the client talks
+  session->Wake();
+}
+
+// only looks at the channel's state, no socket reads, so the session can
+// check every pending open after each pass over its packets
+bool TcpRelay::PollOpen () {
+  if (session->IsClosed()) {
+    Cancel();
+    return false;
+  }
+
+  if (ssh_channel_is_opening(opening))
+    return true;
+
+  // the client's CHANNEL_OPEN_FAILURE leaves it denied rather than open
+  if (ssh_channel_is_open(opening)) {
+    Channel *c = session->WrapChannel(opening);
+    opening = NULL;
+    Start(c);
+    return false;
+  }
+
+  if (NSSH_DEBUG)
+    std::cout << "TcpRelay forwarded-tcpip open refused\n";
+  Cancel();
+  return false;
+}
+
+void TcpRelay::Cancel () {
+  if (opening) {
+    ssh_channel_free(opening);
+    opening = NULL;
+  }
+  Close();
+}
+
+void TcpRelay::Start (Channel *channel) {
+  this->channel = channel;
+  NanDisposePersistent(sessionHandle);
+  uv_tcp_nodelay(tcp, 1);
+  channel->StartPeer(this);
+  uv_read_start(
+      reinterpret_cast<uv_stream_t*>(tcp)
+    , AllocCallback
+    , ReadCallback
+  );
+}
+
+// couldn't connect, the client gets a channel open failure
+void TcpRelay::Refuse () {
+  if (message) {
+    if (!session->IsClosed()) {
+      ssh_message_reply_default(message);
+      session->Wake();
+    }
+    ssh_message_free(message);
+    message = NULL;
+  }
+  Close();
+}
+
+bool TcpRelay::Write (char *data, size_t length) {
+  if (shutdown || closing) {
+    free(data);
+    return true;
+  }
+
+  RelayWrite *write = new RelayWrite;
+  write->data = data;
+  write->length = length;
+  uv_buf_t buf = uv_buf_init(data, length);
+  int rc = uv_write(
+      &write->req
+    , reinterpret_cast<uv_stream_t*>(tcp)
+    , &buf
+    , 1
+    , WriteCallback
+  );
+  if (rc) {
+    free(data);
+    delete write;
+    Fail();
+    return true;
+  }
+
+  writeQueued += length;
+  if (writeQueued >= NSSH_RELAY_BUFFER)
+    inputStopped = true;
+  return !inputStopped;
+}
+
+void TcpRelay::WriteCallback (uv_write_t *req, int status) {
+  RelayWrite *write = reinterpret_cast<RelayWrite*>(req);
+  TcpRelay *r = static_cast<TcpRelay*>(req->handle->data);
+
+  r->writeQueued -= write->length;
+  free(write->data);
+  delete write;
+
+  if (status < 0) {
+    r->Fail();
+    return;
+  }
+
+  if (r->inputStopped && r->writeQueued < NSSH_RELAY_BUFFER) {
+    r->inputStopped = false;
+    if (r->channel)
+      r->channel->PeerInputDrained();
+  }
+}
+
+// the client has sent its EOF, the socket gets one after what's queued
+void TcpRelay::RemoteEof () {
+  if (shutdown || closing)
+    return;
+  shutdown = true;
+
+  uv_shutdown_t *req = new uv_shutdown_t;
+  int rc = uv_shutdown(
+      req
+    , reinterpret_cast<uv_stream_t*>(tcp)
+    , ShutdownCallback
+  );
+  if (rc) {
+    delete req;
+    Fail();
+  }
+}
+
+void TcpRelay::ShutdownCallback (uv_shutdown_t *req, int status) {
+  TcpRelay *r = static_cast<TcpRelay*>(req->handle->data);
+  delete req;
+  if (status < 0)
+    r->Fail();
+  else
+    r->Finish();
+}
+
+void TcpRelay::AllocCallback (
+      uv_handle_t *handle
+    , size_t suggestedSize
+    , uv_buf_t *buf
+  ) {
+
+  buf->base = static_cast<char*>(malloc(suggestedSize));
+  buf->len = buf->base ? suggestedSize : 0;
+}
+
+void TcpRelay::ReadCallback (
+      uv_stream_t *stream
+    , ssize_t nread
+    , const uv_buf_t *buf
+  ) {
+
+  TcpRelay *r = static_cast<TcpRelay*>(stream->data);
+
+  if (nread > 0 && r->channel) {
+    // the channel frees it once it's been sent
+    r->channel->PeerOutput(buf->base, nread, false);
+    if (!r->outputStopped && r->channel->QueuedLength() >= NSSH_RELAY_BUFFER) {
+      // the client isn't keeping up, leave it with the socket for now
+      r->outputStopped = true;
+      uv_read_stop(stream);
+    }
+    return;
+  }
+
+  free(buf->base);
+  if (nread == UV_EOF) {
+    r->tcpEof = true;
+    if (r->channel)
+      r->channel->PeerEof();
+    r->Finish();
+  } else if (nread < 0) {
+    r->Fail();
+  }
+}
+
+void TcpRelay::OutputDrained () {
+  if (!outputStopped || tcpEof || closing || !channel
+      || channel->QueuedLength() >= NSSH_RELAY_BUFFER) {
+    return;
+  }
+
+  outputStopped = false;
+  uv_read_start(
+      reinterpret_cast<uv_stream_t*>(tcp)
+    , AllocCallback
+    , ReadCallback
+  );
+}
+
+// both ends have sent their EOF, the channel can close
+void TcpRelay::Finish () {
+  if (!tcpEof || !shutdown)
+    return;
+  Fail();
+}
+
+// done with the channel one way or another
+void TcpRelay::Fail () {
+  if (channel) {
+    Channel *c = channel;
+    channel = NULL;
+    c->PeerDone();
+  }
+  Close();
+}
+
+void TcpRelay::Detach () {
+  channel = NULL;
+  Close();
+}
+
+void TcpRelay::Close () {
+  if (closing)
+    return;
+  closing = true;
+  NanDisposePersistent(sessionHandle);
+  if (tcp)
+    uv_close(reinterpret_cast<uv_handle_t*>(tcp), ClosedCallback);
+  else
+    delete this;
+}
+
+void TcpRelay::ClosedCallback (uv_handle_t *handle) {
+  TcpRelay *r = static_cast<TcpRelay*>(handle->data);
+  if (NSSH_DEBUG)
+    std::cout << "TcpRelay closed\n";
+  delete reinterpret_cast<uv_tcp_t*>(handle);
+  delete r;
+}
+
+#else // libuv 0.10's tcp and dns APIs aren't worth supporting here
+
+void TcpRelay::Connect (
+      Session *session
+    , ssh_message message
+    , const char *host
+    , int port
+  ) {
+
+  if (!session->IsClosed())
+    ssh_message_reply_default(message);
+  ssh_message_free(message);
+}
+
+void TcpRelay::Open (
+      Session *session
+    , ssh_session sshSession
+    , uv_tcp_t *tcp
+    , const char *address
+    , int port
+  ) {}
+
+bool TcpRelay::PollOpen () {
+  return false;
+}
+
+void TcpRelay::Cancel () {}
+
+bool TcpRelay::Write (char *data, size_t length) {
+  free(data);
+  return true;
+}
+
+void TcpRelay::RemoteEof () {}
+void TcpRelay::OutputDrained () {}
+void TcpRelay::Detach () {}
+
+#endif
+
+} // namespace nssh
@@ -0,0 +1,109 @@
+/* Copyright (c) 2013 Rod Vagg
+ * MIT +no-false-attribs License <https://github.com/rvagg/node-ssh/blob/master/LICENSE>
+ */
+
+#ifndef NSSH_TCP_RELAY_H
+#define NSSH_TCP_RELAY_H
+
+#include <node.h>
+#include <uv.h>
+#include <libssh/server.h>
+#include <nan.h>
+#include <string>
+
+#include "nssh.h"
+#include "channel.h"
+
+namespace nssh {
+
+class Session;
+
+// a forwarded TCP connection relayed to a Channel without going through
+// JS, each side stops reading when the other falls NSSH_RELAY_BUFFER
+// behind and an EOF from either end is passed on to the other. Deletes
+// itself once its socket is closed.
+class TcpRelay : public ChannelPeer {
+ public:
+  // direct-tcpip, connects to host:port and then accepts `message`, or
+  // refuses it if the connection fails
+  static void Connect (
+      Session *session
+    , ssh_message message
+    , const char *host
+    , int port
+  );
+  // forwarded-tcpip, opens a channel to the client for a connection
+  // accepted on the `address`:`port` it asked us to forward
+  static void Open (
+      Session *session
+    , ssh_session sshSession
+    , uv_tcp_t *tcp
+    , const char *address
+    , int port
+  );
+
+  // called by the Session after each pass over its packets while the
+  // client hasn't answered our open, returns false once it has
+  bool PollOpen ();
+  // the Session is going, give up on the open
+  void Cancel ();
+
+  bool Write (char *data, size_t length);
+  void RemoteEof ();
+  void OutputDrained ();
+  void Detach ();
+
+ private:
+  TcpRelay (Session *session);
+
+  static void ResolvedCallback (
+      uv_getaddrinfo_t *req
+    , int status
+    , struct addrinfo *res
+  );
+  static void ConnectCallback (uv_connect_t *req, int status);
+  static void AllocCallback (
+      uv_handle_t *handle
+    , size_t suggestedSize
+    , uv_buf_t *buf
+  );
+  static void ReadCallback (
+      uv_stream_t *stream
+    , ssize_t nread
+    , const uv_buf_t *buf
+  );
+  static void WriteCallback (uv_write_t *req, int status);
+  static void ShutdownCallback (uv_shutdown_t *req, int status);
+  static void ClosedCallback (uv_handle_t *handle);
+
+  void Start (Channel *channel);
+  void Refuse ();
+  void Fail ();
+  void Close ();
+  void Finish ();
+
+  Session *session;
+  // holds the Session until the channel is open
+  v8::Persistent<v8::Object> sessionHandle;
+  ssh_message message;
+  // our forwarded-tcpip channel while the client considers it
+  ssh_channel opening;
+  std::string openAddress;
+  int openPort;
+  std::string originAddress;
+  int originPort;
+  Channel *channel;
+  uv_getaddrinfo_t resolveReq;
+  uv_connect_t connectReq;
+  uv_tcp_t *tcp;
+  bool closing;
+  bool tcpEof;
+  bool shutdown;
+  bool inputStopped;
+  bool outputStopped;
+  size_t writeQueued;
+};
+
+} // namespace nssh
+
+#endif
@@ -60,4 +60,63 @@ test('test createServer() starts a server', function (t) {
     })
     socket.connect(3333)
   }), 'server.listen() returns self')
-})
\ No newline at end of file
+})
+
+test('test reloadHostKeys()', function (t) {
+  t.plan(4)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.listen(3333, function () {
+    t.doesNotThrow(function () {
+      server.reloadHostKeys()
+    }, 'reloads the same keys')
+
+    t.throws(function () {
+      server.reloadHostKeys({ hostRsaKeyFile: __dirname + '/keys/nope' })
+    }, 'throws on a missing key file')
+
+    // the binding reloads whatever it was last given for a key that isn't
+    // passed, that has to be the key that's still loaded
+    t.doesNotThrow(function () {
+      server._server.reloadHostKeys(null, __dirname + '/keys/host_dsa')
+    }, 'failed reload left the old key file in place')
+
+    server.close(function (err) {
+      t.notOk(err, 'no error')
+    })
+  })
+})
+
+test('test listen() reports errors & `reusePort` option', function (t) {
+  t.plan(4)
+
+  function create (options) {
+    options.hostRsaKeyFile = __dirname + '/keys/host_rsa'
+    options.hostDsaKeyFile = __dirname + '/keys/host_dsa'
+    return libssh.createServer(options)
+  }
+
+  var server1 = create({})
+  server1.listen(3333, function (err) {
+    t.notOk(err, 'no error')
+    create({}).listen(3333, function (err) {
+      t.ok(err, 'got an error listening on a port in use')
+      server1.close()
+
+      var server2 = create({ reusePort: true })
+      server2.listen(3334, function (err) {
+        t.notOk(err, 'no error')
+        var server3 = create({ reusePort: true })
+        server3.listen(3334, function (err) {
+          t.notOk(err, 'no error sharing the port with `reusePort`')
+          server2.close()
+          server3.close()
+        })
+      })
+    })
+  })
+})
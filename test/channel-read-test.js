@@ -0,0 +1,198 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , bl      = require('bl')
+    , crypto  = require('crypto')
+    , stream  = require('stream')
+    , executeServerTest = require('./execute-server')
+
+    , privkey = fs.readFileSync(__dirname + '/keys/id_rsa')
+
+
+test('test channels sharing a session all get their data', function (t) {
+  // two channels, each adds a 'channel' and an 'end' to the server's plan
+  t.plan(executeServerTest.plan + 2 + 4)
+
+  // several times the per-channel read budget
+  var bulk = crypto.randomBytes(1024 * 1024)
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      var command = message.execCommand
+      channel.pipe(bl(function (err, buf) {
+        t.notOk(err, 'no error')
+        if (command == 'bulk')
+          t.ok(buf.toString('hex') == bulk.toString('hex'), 'bulk channel got all its data')
+        else
+          t.equal(buf.toString(), 'ping\n', 'small channel got its data')
+        channel.sendExitStatus(0)
+        channel.close()
+      }))
+      message.replySuccess()
+    })
+  }
+
+  function connectionCb (connection) {
+    var closed = 0
+    function onClose () {
+      if (++closed == 2)
+        connection.end()
+    }
+
+    connection.exec('bulk', function (err, stream) {
+      stream.on('close', onClose)
+      stream.end(bulk)
+    })
+    connection.exec('small', function (err, stream) {
+      stream.on('close', onClose)
+      stream.end('ping\n')
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
+
+test('test a slow channel reader gets all its data', function (t) {
+  t.plan(executeServerTest.plan + 3)
+
+  var data = crypto.randomBytes(4 * 1024 * 1024)
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      var received = []
+        , slow     = new stream.Writable({ highWaterMark: 1024 })
+
+      // the channel has to stop reading and let the client's window close
+      slow._write = function (chunk, encoding, callback) {
+        received.push(chunk)
+        setTimeout(callback, 1)
+      }
+      slow.on('finish', function () {
+        var buf = Buffer.concat(received)
+        t.equal(buf.length, data.length, 'got all the data')
+        t.ok(buf.toString('hex') == data.toString('hex'), 'data is intact')
+      })
+      channel.pipe(slow)
+      message.replySuccess()
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('upload', function (err, stream) {
+      t.notOk(err, 'no error')
+      stream.on('close', function () {
+        connection.end()
+      })
+      stream.end(data)
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
+
+test('test reads share slabs without clobbering each other', function (t) {
+  t.plan(executeServerTest.plan + 6)
+
+  // lots of small writes so each read pass has several to batch, and
+  // enough of them to go through a good few 64k slabs
+  var slabSize = 64 * 1024
+    , writes   = []
+    , total    = 0
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  while (total < 1024 * 1024) {
+    writes.push(crypto.randomBytes(1 + Math.floor(Math.random() * 4000)))
+    total += writes[writes.length - 1].length
+  }
+
+  function backing (buf) {
+    return buf.buffer || buf.parent
+  }
+
+  function offset (buf) {
+    return typeof buf.byteOffset == 'number' ? buf.byteOffset : buf.offset
+  }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      // every chunk is held on to, a slab that's still referenced must
+      // never be read into again
+      var chunks = []
+      channel.on('data', function (chunk) {
+        chunks.push(chunk)
+      })
+      channel.on('end', function () {
+        var slabs    = []
+          , ordered  = true
+          , inside   = true
+          , previous = null
+
+        chunks.forEach(function (chunk) {
+          if (slabs.indexOf(backing(chunk)) == -1)
+            slabs.push(backing(chunk))
+          if (offset(chunk) + chunk.length > slabSize)
+            inside = false
+          // the next read in the same slab starts where the last one ended
+          if (previous && backing(previous) == backing(chunk)
+              && offset(chunk) < offset(previous) + previous.length)
+            ordered = false
+          previous = chunk
+        })
+
+        t.ok(slabs.length > 1, 'went through more than one slab')
+        t.ok(inside, 'no chunk crosses the end of its slab')
+        t.ok(ordered, 'chunks in a slab never overlap')
+        t.equal(
+            Buffer.concat(chunks).toString('hex')
+          , Buffer.concat(writes).toString('hex')
+          , 'data is intact'
+        )
+      })
+      message.replySuccess()
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('upload', function (err, stream) {
+      t.notOk(err, 'no error')
+      stream.on('close', function () {
+        t.pass('channel closed')
+        connection.end()
+      })
+      writes.forEach(function (buf) {
+        stream.write(buf)
+      })
+      stream.end()
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
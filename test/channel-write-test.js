@@ -0,0 +1,134 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , bl      = require('bl')
+    , crypto  = require('crypto')
+    , executeServerTest = require('./execute-server')
+
+    , privkey = fs.readFileSync(__dirname + '/keys/id_rsa')
+
+
+test('test writes wait for a slow client', function (t) {
+  t.plan(executeServerTest.plan + 4)
+
+  // well beyond the client's window
+  var data = crypto.randomBytes(8 * 1024 * 1024)
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      message.replySuccess()
+      channel.write(data, function (err) {
+        t.notOk(err, 'write completed once the client had read enough')
+        channel.close()
+      })
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('download', function (err, stream) {
+      t.notOk(err, 'no error')
+      // leave the window closed for a while
+      stream.pause()
+      setTimeout(function () {
+        stream.pipe(bl(function (err, buf) {
+          t.notOk(err, 'no error')
+          t.ok(buf.toString('hex') == data.toString('hex'), 'got all the data intact')
+          connection.end()
+        }))
+      }, 500)
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
+
+test('test channels are closed with their session', function (t) {
+  t.plan(executeServerTest.plan + 3)
+
+  var data = crypto.randomBytes(8 * 1024 * 1024)
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    // nothing to read, but we want the 'end'
+    channel.resume()
+    channel.on('exec', function (message) {
+      message.replySuccess()
+      channel.write(data, function (err) {
+        t.ok(err, 'write failed when the session went')
+      })
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('download', function (err, stream) {
+      t.notOk(err, 'no error')
+      // the write can't finish, hang up on it
+      stream.pause()
+      setTimeout(function () {
+        t.pass('disconnecting')
+        connection.end()
+      }, 500)
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
+
+test('test a download reaches a client that sends nothing', function (t) {
+  t.plan(executeServerTest.plan + 3)
+
+  // within the client's window but well beyond the socket buffers, the
+  // client has no reason to send anything so only a writable poll gets the
+  // rest out of libssh
+  var data = crypto.randomBytes(1024 * 1024)
+    , connectOptions = {
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      message.replySuccess()
+      channel.write(data, function (err) {
+        t.notOk(err, 'no error')
+        channel.close()
+      })
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('download', function (err, stream) {
+      t.notOk(err, 'no error')
+      stream.pipe(bl(function (err, buf) {
+        t.ok(buf.toString('hex') == data.toString('hex'), 'got all the data intact')
+        connection.end()
+      }))
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
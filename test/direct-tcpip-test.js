@@ -0,0 +1,66 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , net     = require('net')
+    , bl      = require('bl')
+    , libssh  = require('../')
+    , SSH2    = require('ssh2')
+
+    , privkey = fs.readFileSync(__dirname + '/keys/id_rsa')
+
+
+test('test directtcpip relay', function (t) {
+  t.plan(6)
+
+  var data = fs.readFileSync(__dirname + '/testdata.bin')
+
+  var echo = net.createServer(function (socket) {
+    socket.pipe(socket)
+  })
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('directtcpip', function (message) {
+      t.equal(message.destHost, 'localhost', 'got destHost')
+      t.equal(message.destPort, echo.address().port, 'got destPort')
+      message.replyForward('127.0.0.1')
+    })
+  })
+
+  echo.listen(0, '127.0.0.1', function () {
+    server.listen(3333, function () {
+      var connection = new SSH2()
+      connection.connect({
+          host: 'localhost'
+        , port: 3333
+        , username: 'foobar'
+        , privateKey: privkey
+      })
+      connection.on('ready', function () {
+        connection.forwardOut('127.0.0.1', 12345, 'localhost', echo.address().port, function (err, stream) {
+          t.notOk(err, 'no error')
+          stream.pipe(bl(function (err, buf) {
+            t.notOk(err, 'no error')
+            t.deepEqual(buf, data, 'got our data back through the relay')
+            connection.end()
+          }))
+          stream.end(data)
+        })
+      })
+      connection.on('error', function (err) {
+        t.fail(err)
+      })
+      connection.on('close', function () {
+        server.close()
+        echo.close()
+        t.pass('closed')
+      })
+    })
+  })
+})
@@ -52,4 +52,56 @@ test('test exec test', function (t) {
   }
 
   executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
-})
\ No newline at end of file
+})
+
+
+test('test native exec', function (t) {
+  t.plan(executeServerTest.plan + 7)
+
+  var connectOptions = {
+      host: 'localhost'
+    , port: 3333
+    , username: 'foobar'
+    , privateKey: privkey
+  }
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      message.replySuccess()
+      channel.execNative(message.execCommand, {
+          env: { PATH: process.env.PATH, EXIT: '3' }
+      })
+      channel.resume() // nothing comes through the stream but its end
+    })
+    channel.on('exit', function (code, signal) {
+      t.equal(code, 3, 'got exit code on server')
+      t.equal(signal, null, 'no signal')
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('cat; echo doobar >&2; exit $EXIT', function (err, stream) {
+      t.notOk(err, 'no error')
+      stream.stderr.pipe(bl(function (err, buf) {
+        t.equal(buf.toString(), 'doobar\n', 'got stderr from the child')
+      }))
+      stream.pipe(bl(function (err, buf) {
+        t.equal(buf.toString(), 'foobar\n', 'child got our stdin and sent it back')
+      }))
+      stream.on('exit', function (code) {
+        t.equal(code, 3, 'got exit code on client')
+      })
+      stream.on('close', function () {
+        t.pass('channel closed by the server')
+        connection.end()
+      })
+      stream.end('foobar\n')
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
@@ -9,6 +9,9 @@ function executeServerTest (t, connectOptions, authCb, channelCb, connectionCb)
 
   server.on('connection', function (session) {
     t.ok(session, '(execute-server) have a session object!')
+    session.on('handshake', function () {
+      t.pass('(execute-server) key exchange complete, triggered "handshake" event')
+    })
     session.on('auth', function (message) {
       t.ok(session, '(execute-server) have a message object, triggered "auth" event')
       authCb(message)
@@ -53,6 +56,6 @@ function executeServerTest (t, connectOptions, authCb, channelCb, connectionCb)
 
   return server
 }
-executeServerTest.plan = 5
+executeServerTest.plan = 6
 
 module.exports = executeServerTest
\ No newline at end of file
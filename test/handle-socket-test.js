@@ -0,0 +1,50 @@
+const libssh = require('../')
+    , test   = require('tap').test
+    , net    = require('net')
+    , SSH2   = require('ssh2')
+
+test('test handleSocket() with a net.Server', function (t) {
+  t.plan(5)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  var netServer = net.createServer({ pauseOnConnect: true }, function (socket) {
+    t.doesNotThrow(function () {
+      server.handleSocket(socket)
+    }, 'server takes the socket')
+  })
+
+  server.on('connection', function (session) {
+    t.ok(session, 'have a session object!')
+    session.on('auth', function (message) {
+      t.equal(message.authUser, 'foobar', 'authenticating over the handed-over socket')
+      message.replyAuthSuccess()
+    })
+  })
+
+  netServer.listen(3333, function () {
+    var connection = new SSH2()
+    connection.on('ready', function () {
+      t.pass('client connected')
+      connection.end()
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      netServer.close()
+      server.close(function (err) {
+        t.notOk(err, 'no error')
+      })
+    })
+    connection.connect({
+        host     : 'localhost'
+      , port     : 3333
+      , username : 'foobar'
+      , password : 'doobar'
+    })
+  })
+})
@@ -0,0 +1,175 @@
+const libssh = require('../')
+    , test   = require('tap').test
+    , net    = require('net')
+    , SSH2   = require('ssh2')
+
+function createServer (options) {
+  options.hostRsaKeyFile = __dirname + '/keys/host_rsa'
+  options.hostDsaKeyFile = __dirname + '/keys/host_dsa'
+  return libssh.createServer(options)
+}
+
+test('test connections are rejected when the handshake queue is full', function (t) {
+  t.plan(5)
+
+  var server = createServer({
+      maxConcurrentHandshakes : 1
+    , maxPendingHandshakes    : 0
+  })
+
+  server.on('connection', function (session) {
+    t.ok(session, 'first connection takes the only handshake slot')
+  })
+
+  server.listen(3333, function () {
+    // never speaks, so it sits in the key exchange
+    var idle = net.connect(3333, 'localhost', function () {
+      var banner   = ''
+        , rejected = net.connect(3333, 'localhost')
+
+      rejected.on('data', function (data) {
+        banner += data
+      })
+      rejected.on('end', function () {
+        t.ok(/^SSH-2\.0-node-libssh/.test(banner), 'rejected connection gets the banner')
+        var stats = server.stats()
+        t.equal(stats.handshakesRejected, 1, 'one rejection counted')
+        t.equal(stats.handshaking, 1, 'one session still handshaking')
+        idle.destroy()
+        server.close(function (err) {
+          t.notOk(err, 'no error')
+        })
+      })
+    })
+  })
+})
+
+test('test queued connections get their handshake in turn', function (t) {
+  t.plan(5)
+
+  var server = createServer({
+        maxConcurrentHandshakes : 1
+      , maxPendingHandshakes    : 1
+    })
+    , idle
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      t.equal(message.authUser, 'foobar', 'queued session authenticating')
+      message.replyAuthSuccess()
+    })
+  })
+
+  server.listen(3333, function () {
+    idle = net.connect(3333, 'localhost', function () {
+      var connection = new SSH2()
+      connection.on('ready', function () {
+        t.pass('queued client connected')
+        connection.end()
+      })
+      connection.on('error', function (err) {
+        t.fail(err)
+      })
+      connection.on('close', function () {
+        server.close(function (err) {
+          t.notOk(err, 'no error')
+        })
+      })
+      connection.connect({
+          host     : 'localhost'
+        , port     : 3333
+        , username : 'foobar'
+        , password : 'doobar'
+      })
+
+      setTimeout(function () {
+        var stats = server.stats()
+        t.equal(stats.handshakesQueued, 1, 'second connection is queued')
+        t.equal(stats.handshaking, 1, 'first connection holds the slot')
+        // hanging up frees the slot for the queued session
+        idle.destroy()
+      }, 200)
+    })
+  })
+})
+
+test('test idle connections give up their handshake slot', function (t) {
+  t.plan(5)
+
+  var server = createServer({
+      maxConcurrentHandshakes : 1
+    , handshakeTimeout        : 200
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+  })
+
+  server.listen(3333, function () {
+    var start = Date.now()
+      // never speaks, it only gets the slot for handshakeTimeout
+      , idle  = net.connect(3333, 'localhost')
+
+    idle.resume()
+    idle.on('close', function () {
+      t.ok(Date.now() - start >= 150, 'hung up on after the timeout')
+      t.equal(server.stats().handshaking, 0, 'slot is free')
+
+      var connection = new SSH2()
+      connection.on('ready', function () {
+        t.pass('next client gets the slot')
+        connection.end()
+      })
+      connection.on('error', function (err) {
+        t.fail(err)
+      })
+      connection.on('close', function () {
+        t.pass('closed')
+        server.close(function (err) {
+          t.notOk(err, 'no error')
+        })
+      })
+      connection.connect({
+          host     : 'localhost'
+        , port     : 3333
+        , username : 'foobar'
+        , password : 'doobar'
+      })
+    })
+  })
+})
+
+test('test closing the server rejects queued connections', function (t) {
+  t.plan(4)
+
+  var server = createServer({
+      maxConcurrentHandshakes : 1
+    , handshakeTimeout        : 0
+  })
+
+  server.listen(3333, function () {
+    var idle = net.connect(3333, 'localhost', function () {
+      var banner = ''
+        , queued = net.connect(3333, 'localhost')
+
+      queued.on('data', function (data) {
+        banner += data
+      })
+      queued.on('end', function () {
+        t.ok(/^SSH-2\.0-node-libssh/.test(banner), 'queued connection gets the banner')
+        idle.destroy()
+      })
+
+      setTimeout(function () {
+        var stats = server.stats()
+        t.equal(stats.handshakesQueued, 1, 'second connection is queued')
+        server.close(function (err) {
+          t.notOk(err, 'no error')
+          t.equal(server.stats().handshakesQueued, 0, 'queue emptied')
+        })
+      }, 200)
+    })
+  })
+})
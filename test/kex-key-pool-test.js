@@ -0,0 +1,55 @@
+const libssh = require('../')
+    , test   = require('tap').test
+    , SSH2   = require('ssh2')
+
+test('test handshakes take ephemeral keys from `kexKeyPool`', function (t) {
+  t.plan(6)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+    , kexKeyPool     : 2
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+  })
+
+  function connect (callback) {
+    var connection = new SSH2()
+    connection.on('ready', function () {
+      t.pass('client connected')
+      connection.end()
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', callback)
+    connection.connect({
+        host     : 'localhost'
+      , port     : 3333
+      , username : 'foobar'
+      , password : 'doobar'
+    })
+  }
+
+  server.listen(3333, function () {
+    connect(function () {
+      var stats = server.stats()
+      t.equal(stats.kexKeyPoolMisses, 1, 'first handshake generates its own keypair')
+      t.equal(stats.kexKeyPoolHits, 0, 'nothing pooled yet')
+
+      // give the threadpool a moment to fill the pool
+      setTimeout(function () {
+        connect(function () {
+          t.equal(server.stats().kexKeyPoolHits, 1, 'second handshake uses a pooled keypair')
+          server.close(function (err) {
+            t.notOk(err, 'no error')
+          })
+        })
+      }, 200)
+    })
+  })
+})
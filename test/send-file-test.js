@@ -0,0 +1,63 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , bl      = require('bl')
+    , executeServerTest = require('./execute-server')
+
+    , privkey  = fs.readFileSync(__dirname + '/keys/id_rsa')
+    , testfile = __dirname + '/testdata.bin'
+
+
+test('test sendFile', function (t) {
+  t.plan(executeServerTest.plan + 7)
+
+  var connectOptions = {
+      host: 'localhost'
+    , port: 3333
+    , username: 'foobar'
+    , privateKey: privkey
+  }
+    , expected = Buffer.concat([
+          fs.readFileSync(testfile).slice(100, 4100)
+        , fs.readFileSync(testfile)
+      ])
+
+  function authCb (message) {
+    return message.replyAuthSuccess()
+  }
+
+  function channelCb (channel) {
+    channel.on('exec', function (message) {
+      message.replySuccess()
+      channel.resume()
+      channel.sendFile(testfile, { offset: 100, length: 4000 }, function (err, sent) {
+        t.notOk(err, 'no error')
+        t.equal(sent, 4000, 'sent the part of the file we asked for')
+
+        var fd = fs.openSync(testfile, 'r')
+        channel.sendFile(fd, function (err, sent) {
+          fs.closeSync(fd)
+          t.notOk(err, 'no error')
+          t.equal(sent, expected.length - 4000, 'sent the whole file from an fd')
+          channel.sendEof()
+          channel.sendExitStatus(0)
+          channel.close()
+        })
+      })
+      t.throws(function () {
+        channel.sendFile(testfile, function () {})
+      }, 'one sendFile() at a time')
+    })
+  }
+
+  function connectionCb (connection) {
+    connection.exec('download', function (err, stream) {
+      t.notOk(err, 'no error')
+      stream.pipe(bl(function (err, buf) {
+        t.deepEqual(buf, expected, 'got the file contents')
+        connection.end()
+      }))
+    })
+  }
+
+  executeServerTest(t, connectOptions, authCb, channelCb, connectionCb)
+})
@@ -0,0 +1,178 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , os      = require('os')
+    , path    = require('path')
+    , libssh  = require('../')
+    , SSH2    = require('ssh2')
+    , md5     = require('./util').md5
+
+    , privkey  = fs.readFileSync(__dirname + '/keys/id_rsa')
+    , testfile = __dirname + '/testdata.bin'
+
+
+test('test native sftp root', function (t) {
+  t.plan(14)
+
+  var root = path.join(os.tmpdir(), 'nssh-sftp-' + Date.now())
+    , dstfile = path.join(os.tmpdir(), 'nssh-sftp-dst-' + Date.now())
+    , filtered = []
+
+  fs.mkdirSync(root)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('channel', function (channel) {
+      channel.on('subsystem', function (message) {
+        t.throws(function () {
+          message.sftpAccept({ root: testfile })
+        }, 'root has to be a directory')
+        message.replySuccess()
+        message.sftpAccept({
+            root   : root
+          , filter : function (type, path) {
+              filtered.push(type + ' ' + path)
+              return path.indexOf('/secret') !== 0
+            }
+        })
+      })
+      channel.on('sftpmessage', function () {
+        t.fail('native requests should not reach JS')
+      })
+    })
+  })
+
+  server.listen(3333, function () {
+    var connection = new SSH2()
+    connection.connect({
+        host: 'localhost'
+      , port: 3333
+      , username: 'foobar'
+      , privateKey: privkey
+    })
+    connection.on('ready', function () {
+      connection.sftp(function (err, sftp) {
+        t.notOk(err, 'no error')
+        // lots in flight at once, replies come back in whatever order
+        sftp.fastPut(testfile, '/../up/../data.bin', { concurrency: 64, chunkSize: 100 }, function (err) {
+          t.notOk(err, 'no error')
+          t.equal(
+              md5(fs.readFileSync(path.join(root, 'data.bin')))
+            , md5(fs.readFileSync(testfile))
+            , 'written inside the root'
+          )
+          sftp.fastGet('/data.bin', dstfile, { concurrency: 64, chunkSize: 100 }, function (err) {
+            t.notOk(err, 'no error')
+            t.equal(
+                md5(fs.readFileSync(dstfile))
+              , md5(fs.readFileSync(testfile))
+              , 'same data!'
+            )
+            sftp.mkdir('/dir', function (err) {
+              t.notOk(err, 'no error')
+              sftp.readdir('/', function (err, list) {
+                t.notOk(err, 'no error')
+                t.deepEqual(
+                    list.map(function (e) { return e.filename }).sort()
+                  , [ 'data.bin', 'dir' ]
+                  , 'listed the root'
+                )
+                t.equal(
+                    list.filter(function (e) { return e.filename == 'data.bin' })[0].attrs.size
+                  , fs.statSync(testfile).size
+                  , 'with attributes'
+                )
+                sftp.mkdir('/secret', function (err) {
+                  t.ok(err, 'filter denied it')
+                  t.notOk(fs.existsSync(path.join(root, 'secret')), 'nothing made')
+                  t.ok(filtered.indexOf('mkdir /dir') != -1, 'filter saw the path')
+                  connection.end()
+                })
+              })
+            })
+          })
+        })
+      })
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      server.close()
+      fs.unlinkSync(dstfile)
+      fs.unlinkSync(path.join(root, 'data.bin'))
+      fs.rmdirSync(path.join(root, 'dir'))
+      fs.rmdirSync(root)
+      t.pass('closed')
+    })
+  })
+})
+
+test('test native sftp symlinks stay in the root', function (t) {
+  t.plan(5)
+
+  var root = path.join(os.tmpdir(), 'nssh-sftp-link-' + Date.now())
+
+  fs.mkdirSync(root)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('channel', function (channel) {
+      channel.on('subsystem', function (message) {
+        message.replySuccess()
+        message.sftpAccept({ root: root })
+      })
+    })
+  })
+
+  server.listen(3333, function () {
+    var connection = new SSH2()
+    connection.connect({
+        host: 'localhost'
+      , port: 3333
+      , username: 'foobar'
+      , privateKey: privkey
+    })
+    connection.on('ready', function () {
+      connection.sftp(function (err, sftp) {
+        t.notOk(err, 'no error')
+        // ssh2 only swaps the arguments for OpenSSH servers, so this puts
+        // '../../../../etc' in the target position we read
+        sftp.symlink('/link', '../../../../etc', function (err) {
+          t.notOk(err, 'no error')
+          t.equal(
+              fs.readlinkSync(path.join(root, 'link')).indexOf(root)
+            , 0
+            , 'link points inside the root'
+          )
+          sftp.open('/link/passwd', 'r', function (err) {
+            t.ok(err, 'could not follow it out of the root')
+            connection.end()
+          })
+        })
+      })
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      server.close()
+      fs.unlinkSync(path.join(root, 'link'))
+      fs.rmdirSync(root)
+      t.pass('closed')
+    })
+  })
+})
@@ -0,0 +1,77 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , libssh  = require('../')
+    , SSH2    = require('ssh2')
+    , md5     = require('./util').md5
+
+    , privkey  = fs.readFileSync(__dirname + '/keys/id_rsa')
+    , testfile = __dirname + '/testdata.bin'
+
+
+test('test sftp write data', function (t) {
+  t.plan(6)
+
+  var data   = fs.readFileSync(testfile)
+    , chunks = []
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('channel', function (channel) {
+      channel.on('subsystem', function (message) {
+        message.replySuccess()
+        message.sftpAccept()
+      })
+      channel.on('sftp:open', function (message) {
+        message.replyHandle('upload')
+      })
+      channel.on('sftp:write', function (message) {
+        // hold on to the Buffers, they have to outlive the message
+        chunks.push({ offset: message.offset, data: message.data })
+        message.replyStatus('ok')
+      })
+      channel.on('sftp:close', function (message) {
+        message.replyStatus('ok')
+      })
+    })
+  })
+
+  server.listen(3333, function () {
+    var connection = new SSH2()
+    connection.connect({
+        host: 'localhost'
+      , port: 3333
+      , username: 'foobar'
+      , privateKey: privkey
+    })
+    connection.on('ready', function () {
+      connection.sftp(function (err, sftp) {
+        t.notOk(err, 'no error')
+        sftp.fastPut(testfile, '/upload', { concurrency: 4, chunkSize: 100 }, function (err) {
+          t.notOk(err, 'no error')
+          t.ok(chunks.every(function (c) { return Buffer.isBuffer(c.data) }), 'got Buffers')
+          var received = new Buffer(data.length)
+          chunks.forEach(function (c) {
+            c.data.copy(received, c.offset)
+          })
+          t.equal(chunks.length, Math.ceil(data.length / 100), 'got every chunk')
+          t.equal(md5(received), md5(data), 'same data!')
+          connection.end()
+        })
+      })
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      server.close()
+      t.pass('closed')
+    })
+  })
+})
@@ -0,0 +1,114 @@
+const test    = require('tap').test
+    , fs      = require('fs')
+    , net     = require('net')
+    , bl      = require('bl')
+    , libssh  = require('../')
+    , SSH2    = require('ssh2')
+
+    , privkey = fs.readFileSync(__dirname + '/keys/id_rsa')
+
+
+test('test tcpipforward relay', function (t) {
+  t.plan(6)
+
+  var data = fs.readFileSync(__dirname + '/testdata.bin')
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('tcpipforward', function (message) {
+      t.equal(message.bindPort, 3334, 'got bindPort')
+      t.ok(message.replyForward(), 'listening')
+    })
+  })
+
+  server.listen(3333, function () {
+    var connection = new SSH2()
+    connection.connect({
+        host: 'localhost'
+      , port: 3333
+      , username: 'foobar'
+      , privateKey: privkey
+    })
+    connection.on('ready', function () {
+      connection.forwardIn('127.0.0.1', 3334, function (err) {
+        t.notOk(err, 'no error')
+        var socket = net.connect(3334, '127.0.0.1')
+        socket.pipe(bl(function (err, buf) {
+          t.notOk(err, 'no error')
+          t.deepEqual(buf, data, 'got our data back through the relay')
+          connection.end()
+        }))
+        socket.end(data)
+      })
+    })
+    // echo whatever comes in on the forwarded channel
+    connection.on('tcp connection', function (info, accept) {
+      var stream = accept()
+      stream.pipe(stream)
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      server.close()
+      t.pass('closed')
+    })
+  })
+})
+
+test('test tcpipforward refused by the client', function (t) {
+  t.plan(4)
+
+  var server = libssh.createServer({
+      hostRsaKeyFile : __dirname + '/keys/host_rsa'
+    , hostDsaKeyFile : __dirname + '/keys/host_dsa'
+  })
+
+  server.on('connection', function (session) {
+    session.on('auth', function (message) {
+      message.replyAuthSuccess()
+    })
+    session.on('tcpipforward', function (message) {
+      t.ok(message.replyForward(), 'listening')
+    })
+  })
+
+  server.listen(3333, function () {
+    var connection = new SSH2()
+    connection.connect({
+        host: 'localhost'
+      , port: 3333
+      , username: 'foobar'
+      , privateKey: privkey
+    })
+    connection.on('ready', function () {
+      connection.forwardIn('127.0.0.1', 3334, function (err) {
+        t.notOk(err, 'no error')
+        var socket = net.connect(3334, '127.0.0.1')
+        socket.resume()
+        // the relay gives up on the connection rather than sitting on it
+        socket.on('close', function () {
+          t.pass('forwarded connection closed')
+          connection.end()
+        })
+      })
+    })
+    connection.on('tcp connection', function (info, accept, reject) {
+      reject()
+    })
+    connection.on('error', function (err) {
+      t.fail(err)
+    })
+    connection.on('close', function () {
+      server.close()
+      t.pass('closed')
+    })
+  })
+})